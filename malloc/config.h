@@ -85,7 +85,8 @@
 #define ALIGNMENT 16
 
 /*
- * Maximum heap size in bytes
+ * Default maximum heap size in bytes. The driver can override it at
+ * runtime with the -m flag.
  */
 #define MAX_HEAP (100*(1<<20))  /* 100 MB */
 
@@ -54,10 +54,13 @@ typedef struct
   {
     ALLOC,
     FREE,
-    REALLOC
+    REALLOC,
+    BATCH_ALLOC,
+    BATCH_FREE
   } type;         /* type of request */
   unsigned index; /* index for free() to use later */
   unsigned size;  /* byte size of alloc/realloc request */
+  unsigned count; /* number of consecutive ids in a batch request */
 } traceop_t;
 
 /* Holds the information for one trace file*/
@@ -70,6 +73,7 @@ typedef struct
   traceop_t *ops;         /* array of requests */
   unsigned char **blocks; /* array of ptrs returned by malloc/realloc... */
   uint32_t *block_sizes;    /* ... and a corresponding array of payload sizes */
+  void **batch;           /* scratch array for batch requests */
 } trace_t;
 
 /*
@@ -83,6 +87,13 @@ typedef struct
   range_t *ranges;
 } speed_t;
 
+/* Params of the small request benchmark (-S), timed by fcyc */
+typedef struct
+{
+  uint32_t size; /* request size */
+  int libc;      /* time libc malloc instead of mm malloc? */
+} small_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct
 {
@@ -93,6 +104,8 @@ typedef struct
 
   /* defined only for the student malloc package */
   long double util; /* space utilization for this trace (always 0 for libc) */
+  long double heap; /* heap size in bytes after running the trace */
+  long double alt_secs; /* secs with the other page size (-C only) */
 
   /* Note: secs and util are only defined if valid is true */
 } stats_t;
@@ -145,10 +158,18 @@ eval_mm_util (trace_t *trace);
 static void
 eval_mm_speed (void *ptr);
 
+/* Routines for timing small requests in isolation (-S) */
+static void
+eval_small_speed (void *ptr);
+static void
+run_small_bench (void);
+
 /* Various helper routines */
 static void
 printresults (unsigned n, stats_t *stats);
 static void
+printpagecompare (unsigned n, stats_t *stats, int hugepages);
+static void
 usage (void);
 static void
 unix_error (char *msg);
@@ -172,7 +193,11 @@ main (int argc, char **argv)
   speed_t speed_params;        /* input parameters to the xx_speed routines */
 
   int run_libc = 0;   /* If set, run libc malloc (set by -l) */
+  char *end;          /* for parsing numeric arguments */
   int autograder = 0; /* If set, emit summary info for autograder (-g) */
+  int hugepages = 0;  /* If set, back the heap with huge pages (-H) */
+  int compare = 0;    /* If set, also time the other page size (-C) */
+  int small_bench = 0; /* If set, only time small requests (-S) */
 
   /* temporaries used to compute the performance index */
   long double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -182,7 +207,7 @@ main (int argc, char **argv)
      * Read and interpret the command line arguments
      */
   int c;
-  while ((c = getopt (argc, argv, "f:t:hvVgal")) != EOF)
+  while ((c = getopt (argc, argv, "f:t:m:hvVgalrHCS")) != EOF)
   {
     switch (c)
     {
@@ -207,6 +232,29 @@ main (int argc, char **argv)
       case 'l': /* Run libc malloc */
         run_libc = 1;
         break;
+      case 'm': /* Size of the simulated heap in megabytes */
+        {
+          unsigned long long mb = strtoull (optarg, &end, 0);
+          if (mb == 0 || *end != '\0')
+          {
+            usage ();
+            exit (1);
+          }
+          mem_set_max_heap ((size_t) mb << 20);
+        }
+        break;
+      case 'r': /* Return heap pages to the kernel between runs */
+        mem_set_trim (1);
+        break;
+      case 'H': /* Align the heap to 2 MB and use transparent huge pages */
+        hugepages = 1;
+        break;
+      case 'C': /* Compare throughput with 4 KB pages and huge pages */
+        compare = 1;
+        break;
+      case 'S': /* Benchmark the small request fast path and exit */
+        small_bench = 1;
+        break;
       case 'v': /* Print per-trace performance breakdown */
         verbose = 1;
         break;
@@ -222,6 +270,15 @@ main (int argc, char **argv)
     }
   }
 
+  if (small_bench)
+  {
+    init_fsecs ();
+    mem_set_hugepages (hugepages);
+    mem_init ();
+    run_small_bench ();
+    exit (0);
+  }
+
   /*
      * If no -f command line arg, then use the entire set of tracefiles
      * defined in default_traces[]
@@ -287,6 +344,7 @@ main (int argc, char **argv)
     unix_error ("mm_stats calloc in main failed");
 
   /* Initialize the simulated memory system in memlib.c */
+  mem_set_hugepages (hugepages);
   mem_init ();
 
   /* Evaluate student's mm malloc package using the K-best scheme */
@@ -307,6 +365,21 @@ main (int argc, char **argv)
       if (verbose > 1)
         printf ("and performance.\n");
       mm_stats[i].secs = fsecs (eval_mm_speed, &speed_params);
+      mm_stats[i].heap = mem_heapsize ();
+      if (compare)
+      {
+        /* Rebuild the simulated heap with the other page size */
+        if (verbose > 1)
+          printf ("Timing with %s pages.\n", hugepages ? "4 KB" : "huge");
+        mem_deinit ();
+        mem_set_hugepages (!hugepages);
+        mem_init ();
+        eval_mm_speed (&speed_params); /* fault the pages in first */
+        mm_stats[i].alt_secs = fsecs (eval_mm_speed, &speed_params);
+        mem_deinit ();
+        mem_set_hugepages (hugepages);
+        mem_init ();
+      }
     }
     free_trace (trace);
   }
@@ -319,6 +392,12 @@ main (int argc, char **argv)
     printf ("\n");
   }
 
+  if (compare)
+  {
+    printpagecompare (num_tracefiles, mm_stats, hugepages);
+    printf ("\n");
+  }
+
   /*
      * Accumulate the aggregate statistics for the student's mm package
      */
@@ -491,8 +570,9 @@ read_trace (char *tracedir, char *filename)
   trace_t *trace;
   char type[MAXLINE];
   char path[MAXLINE];
-  unsigned index, size;
+  unsigned index, size, count;
   unsigned max_index = 0;
+  unsigned max_count = 1;
   unsigned op_index;
 
   if (verbose > 1)
@@ -556,6 +636,27 @@ read_trace (char *tracedir, char *filename)
         trace->ops[op_index].type = FREE;
         trace->ops[op_index].index = index;
         break;
+      case 'A': /* A index count size: allocate ids index..index+count-1 */
+        fscanf (tracefile, "%u %u %u", &index, &count, &size);
+        if (count == 0)
+          app_error ("Batch request of zero blocks in tracefile");
+        trace->ops[op_index].type = BATCH_ALLOC;
+        trace->ops[op_index].index = index;
+        trace->ops[op_index].count = count;
+        trace->ops[op_index].size = size;
+        max_index = (index + count - 1 > max_index) ? index + count - 1
+                                                    : max_index;
+        max_count = (count > max_count) ? count : max_count;
+        break;
+      case 'F': /* F index count: free ids index..index+count-1 */
+        fscanf (tracefile, "%u %u", &index, &count);
+        if (count == 0)
+          app_error ("Batch request of zero blocks in tracefile");
+        trace->ops[op_index].type = BATCH_FREE;
+        trace->ops[op_index].index = index;
+        trace->ops[op_index].count = count;
+        max_count = (count > max_count) ? count : max_count;
+        break;
       default:
         printf ("Bogus type character (%c) in tracefile %s\n", type[0], path);
         exit (1);
@@ -566,19 +667,24 @@ read_trace (char *tracedir, char *filename)
   assert (max_index == trace->num_ids - 1);
   assert (trace->num_ops == op_index);
 
+  /* Batch requests hand the allocator an array of pointers */
+  if ((trace->batch = malloc (max_count * sizeof (void *))) == NULL)
+    unix_error ("malloc 5 failed in read_trace");
+
   return trace;
 }
 
 /*
- * free_trace - Free the trace record and the three arrays it points
+ * free_trace - Free the trace record and the four arrays it points
  *              to, all of which were allocated in read_trace().
  */
 void
 free_trace (trace_t *trace)
 {
-  free (trace->ops); /* free the three arrays... */
+  free (trace->ops); /* free the four arrays... */
   free (trace->blocks);
   free (trace->block_sizes);
+  free (trace->batch);
   free (trace); /* and the trace record itself... */
 }
 
@@ -593,7 +699,7 @@ free_trace (trace_t *trace)
 static int
 eval_mm_valid (trace_t *trace, unsigned tracenum, range_t **ranges)
 {
-  unsigned index;
+  unsigned index, count;
   uint32_t size;
   uint32_t oldsize;
   unsigned char *newp;
@@ -699,6 +805,38 @@ eval_mm_valid (trace_t *trace, unsigned tracenum, range_t **ranges)
         mm_free (p);
         break;
 
+      case BATCH_ALLOC: /* mm_malloc_batch */
+
+        count = trace->ops[i].count;
+        if (mm_malloc_batch (size, count, trace->batch) != count)
+        {
+          malloc_error (tracenum, i, "mm_malloc_batch failed.");
+          return 0;
+        }
+
+        /* Every block is checked and filled just like a single malloc */
+        for (unsigned j = 0; j < count; j++)
+        {
+          p = trace->batch[j];
+          if (add_range (ranges, p, size, tracenum, i) == 0)
+            return 0;
+          memset (p, (index + j) & 0xFF, size);
+          trace->blocks[index + j] = p;
+          trace->block_sizes[index + j] = size;
+        }
+        break;
+
+      case BATCH_FREE: /* mm_free_batch */
+
+        count = trace->ops[i].count;
+        for (unsigned j = 0; j < count; j++)
+        {
+          trace->batch[j] = trace->blocks[index + j];
+          remove_range (ranges, trace->blocks[index + j]);
+        }
+        mm_free_batch (trace->batch, count);
+        break;
+
       default:
         app_error ("Nonexistent request type in eval_mm_valid");
     }
@@ -722,10 +860,10 @@ eval_mm_valid (trace_t *trace, unsigned tracenum, range_t **ranges)
 static long double
 eval_mm_util (trace_t *trace)
 {
-  uint32_t index;
+  uint32_t index, count;
   uint32_t size, newsize, oldsize;
-  uint32_t max_total_size = 0;
-  uint32_t total_size = 0;
+  size_t max_total_size = 0;
+  size_t total_size = 0;
   unsigned char *p;
   unsigned char *newp, *oldp;
 
@@ -794,6 +932,37 @@ eval_mm_util (trace_t *trace)
 
         break;
 
+      case BATCH_ALLOC: /* mm_malloc_batch */
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+        count = trace->ops[i].count;
+
+        if (mm_malloc_batch (size, count, trace->batch) != count)
+          app_error ("mm_malloc_batch failed in eval_mm_util");
+
+        for (unsigned j = 0; j < count; j++)
+        {
+          trace->blocks[index + j] = trace->batch[j];
+          trace->block_sizes[index + j] = size;
+        }
+
+        total_size += (size_t) size * count;
+        max_total_size =
+          (total_size > max_total_size) ? total_size : max_total_size;
+        break;
+
+      case BATCH_FREE: /* mm_free_batch */
+        index = trace->ops[i].index;
+        count = trace->ops[i].count;
+
+        for (unsigned j = 0; j < count; j++)
+        {
+          trace->batch[j] = trace->blocks[index + j];
+          total_size -= trace->block_sizes[index + j];
+        }
+        mm_free_batch (trace->batch, count);
+        break;
+
       default:
         app_error ("Nonexistent request type in eval_mm_util");
     }
@@ -809,7 +978,7 @@ eval_mm_util (trace_t *trace)
 static void
 eval_mm_speed (void *ptr)
 {
-  unsigned i, index, size, newsize;
+  unsigned i, index, size, newsize, count;
   unsigned char *p, *newp, *oldp, *block;
   trace_t *trace = ((speed_t *)ptr)->trace;
 
@@ -845,11 +1014,94 @@ eval_mm_speed (void *ptr)
         mm_free (block);
         break;
 
+      case BATCH_ALLOC: /* mm_malloc_batch */
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+        count = trace->ops[i].count;
+        if (mm_malloc_batch (size, count, trace->batch) != count)
+          app_error ("mm_malloc_batch error in eval_mm_speed");
+        for (unsigned j = 0; j < count; j++)
+          trace->blocks[index + j] = trace->batch[j];
+        break;
+
+      case BATCH_FREE: /* mm_free_batch */
+        index = trace->ops[i].index;
+        count = trace->ops[i].count;
+        for (unsigned j = 0; j < count; j++)
+          trace->batch[j] = trace->blocks[index + j];
+        mm_free_batch (trace->batch, count);
+        break;
+
       default:
         app_error ("Nonexistent request type in eval_mm_valid");
     }
 }
 
+/*
+ * eval_small_speed - used by fcyc() to time SMALL_DEPTH malloc calls of
+ *    one size followed by freeing the blocks, SMALL_ROUNDS times over.
+ *    With a warm heap every request is served by the size class bins.
+ */
+#define SMALL_DEPTH 32
+#define SMALL_ROUNDS 1000
+
+static void
+eval_small_speed (void *ptr)
+{
+  small_t *params = (small_t *)ptr;
+  void *blocks[SMALL_DEPTH];
+
+  for (unsigned r = 0; r < SMALL_ROUNDS; r++)
+  {
+    for (unsigned j = 0; j < SMALL_DEPTH; j++)
+    {
+      blocks[j] = params->libc ? malloc (params->size)
+                               : mm_malloc (params->size);
+      if (blocks[j] == NULL)
+        app_error ("malloc failed in eval_small_speed");
+    }
+    for (unsigned j = SMALL_DEPTH; j > 0; j--)
+    {
+      if (params->libc)
+        free (blocks[j - 1]);
+      else
+        mm_free (blocks[j - 1]);
+    }
+  }
+}
+
+/*
+ * run_small_bench - prints ns per malloc/free call for small sizes,
+ *    for mm malloc and libc malloc
+ */
+static void
+run_small_bench (void)
+{
+  static const uint32_t sizes[] = {8, 16, 24, 48, 100, 256, 1000, 4000};
+  long double calls = 2.0L * SMALL_DEPTH * SMALL_ROUNDS;
+  small_t params;
+
+  printf ("%6s%12s%12s\n", "size", "mm ns/op", "libc ns/op");
+  for (unsigned i = 0; i < sizeof (sizes) / sizeof (sizes[0]); i++)
+  {
+    params.size = sizes[i];
+
+    /* Warm up so the timed rounds only pop and push bins */
+    params.libc = 0;
+    mem_reset_brk ();
+    if (mm_init () < 0)
+      app_error ("mm_init failed in run_small_bench");
+    eval_small_speed (&params);
+    long double mm_secs = fsecs (eval_small_speed, &params);
+
+    params.libc = 1;
+    long double libc_secs = fsecs (eval_small_speed, &params);
+
+    printf ("%6u%12.2Lf%12.2Lf\n", sizes[i], mm_secs * 1e9L / calls,
+            libc_secs * 1e9L / calls);
+  }
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -891,6 +1143,23 @@ eval_libc_valid (trace_t *trace, unsigned tracenum)
         free (trace->blocks[trace->ops[i].index]);
         break;
 
+      case BATCH_ALLOC: /* libc has no batch malloc; one at a time */
+        for (unsigned j = 0; j < trace->ops[i].count; j++)
+        {
+          if ((p = malloc (trace->ops[i].size)) == NULL)
+          {
+            malloc_error (tracenum, i, "libc malloc failed");
+            unix_error ("System message");
+          }
+          trace->blocks[trace->ops[i].index + j] = p;
+        }
+        break;
+
+      case BATCH_FREE:
+        for (unsigned j = 0; j < trace->ops[i].count; j++)
+          free (trace->blocks[trace->ops[i].index + j]);
+        break;
+
       default:
         app_error ("invalid operation type  in eval_libc_valid");
     }
@@ -939,6 +1208,23 @@ eval_libc_speed (void *ptr)
         block = trace->blocks[index];
         free (block);
         break;
+
+      case BATCH_ALLOC: /* libc has no batch malloc; one at a time */
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+        for (unsigned j = 0; j < trace->ops[i].count; j++)
+        {
+          if ((p = malloc (size)) == NULL)
+            unix_error ("malloc failed in eval_libc_speed");
+          trace->blocks[index + j] = p;
+        }
+        break;
+
+      case BATCH_FREE:
+        index = trace->ops[i].index;
+        for (unsigned j = 0; j < trace->ops[i].count; j++)
+          free (trace->blocks[index + j]);
+        break;
     }
   }
 }
@@ -985,6 +1271,31 @@ printresults (unsigned n, stats_t *stats)
   }
 }
 
+/*
+ * printpagecompare - prints mm throughput with 4 KB pages next to
+ *     throughput with transparent huge pages for every trace
+ */
+static void
+printpagecompare (unsigned n, stats_t *stats, int hugepages)
+{
+  printf ("Page size comparison for mm malloc:\n");
+  printf ("%5s%10s%10s%12s%12s%9s\n", "trace", "ops", "heap MB", "4K Kops",
+          "2M Kops", "speedup");
+  for (unsigned i = 0; i < n; i++)
+  {
+    if (!stats[i].valid)
+    {
+      printf ("%2u%13s%10s%12s%12s%9s\n", i, "-", "-", "-", "-", "-");
+      continue;
+    }
+    long double small = hugepages ? stats[i].alt_secs : stats[i].secs;
+    long double huge = hugepages ? stats[i].secs : stats[i].alt_secs;
+    printf ("%2u%13.0Lf%10.1Lf%12.2Lf%12.2Lf%8.2Lfx\n", i, stats[i].ops,
+            stats[i].heap / (1 << 20), (stats[i].ops / 1e3) / small,
+            (stats[i].ops / 1e3) / huge, small / huge);
+  }
+}
+
 /*
  * app_error - Report an arbitrary application error
  */
@@ -1021,12 +1332,19 @@ malloc_error (unsigned tracenum, unsigned opnum, char *msg)
 static void
 usage (void)
 {
-  fprintf (stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+  fprintf (stderr,
+           "Usage: mdriver [-hvVglrHCS] [-f <file>] [-t <dir>] [-m <MB>]\n");
   fprintf (stderr, "Options\n");
   fprintf (stderr, "\t-f <file>  Use <file> as the trace file.\n");
   fprintf (stderr, "\t-g         Generate summary info for autograder.\n");
+  fprintf (stderr, "\t-C         Compare throughput with 4 KB and huge pages.\n");
+  fprintf (stderr, "\t-H         Back the heap with transparent huge pages.\n");
+  fprintf (stderr, "\t-S         Time small malloc/free calls and exit.\n");
   fprintf (stderr, "\t-h         Print this message.\n");
   fprintf (stderr, "\t-l         Run libc malloc as well.\n");
+  fprintf (stderr, "\t-m <MB>    Size of the simulated heap (default %d).\n",
+           MAX_HEAP >> 20);
+  fprintf (stderr, "\t-r         Return heap pages to the OS between runs.\n");
   fprintf (stderr, "\t-t <dir>   Directory to find default traces.\n");
   fprintf (stderr, "\t-v         Print per-trace performance breakdowns.\n");
   fprintf (stderr, "\t-V         Print additional debug info.\n");
@@ -7,6 +7,8 @@
  *
  */
 
+#define _DEFAULT_SOURCE 1
+
 #include <assert.h>
 #include <errno.h>
 #include <stdio.h>
@@ -18,25 +20,98 @@
 #include "config.h"
 #include "memlib.h"
 
-static char *mem_start_brk; /* points to first byte of heap */
-static char *mem_brk;       /* points to last byte of heap */
-static char *mem_max_addr;  /* largest legal heap address */
+static char *mem_start_brk;  /* points to first byte of heap */
+static char *mem_brk;        /* points to last byte of heap */
+static char *mem_max_addr;   /* largest legal heap address */
+static char *mem_commit_brk; /* end of the pages made accessible so far */
+
+static size_t mem_max_heap = MAX_HEAP; /* size of the reservation */
+static int mem_trim = 0;               /* give back pages on reset? */
+static int mem_hugepages = 0;          /* back heap with huge pages? */
+
+/* Heap pages are made accessible in steps of this many bytes */
+#define COMMIT_CHUNK (256 * 1024)
+
+/* Size and alignment of a transparent huge page */
+#define HUGE_PAGE (2 * 1024 * 1024)
+
+/*
+ * round_up - round bytes up to a multiple of unit (a power of two)
+ */
+static size_t
+round_up (size_t bytes, size_t unit)
+{
+  return (bytes + unit - 1) & ~(unit - 1);
+}
+
+/*
+ * mem_set_max_heap - set the size of the heap reservation. Must be
+ *    called before mem_init; defaults to MAX_HEAP.
+ */
+void
+mem_set_max_heap (size_t bytes)
+{
+  mem_max_heap = round_up (bytes, mem_pagesize ());
+}
+
+/*
+ * mem_set_trim - when on, mem_reset_brk hands the pages of the old
+ *    heap back to the kernel with madvise(MADV_DONTNEED)
+ */
+void
+mem_set_trim (int on)
+{
+  mem_trim = on;
+}
+
+/*
+ * mem_set_hugepages - when on, mem_init aligns the heap to 2 MB and asks
+ *    for transparent huge pages. Must be called before mem_init.
+ */
+void
+mem_set_hugepages (int on)
+{
+  mem_hugepages = on;
+}
 
 /*
  * mem_init - initialize the memory system model
+ *
+ *    Only address space is reserved here (PROT_NONE, MAP_NORESERVE);
+ *    mem_sbrk makes pages accessible as the brk pointer advances, so
+ *    untouched parts of the heap cost no memory.
  */
 void
 mem_init (void)
 {
-  /* allocate the storage we will use to model the available VM */
-  if ((mem_start_brk = (char *)malloc (MAX_HEAP)) == NULL)
+  size_t slop = mem_hugepages ? HUGE_PAGE : 0;
+  void *base = mmap (NULL, mem_max_heap + slop, PROT_NONE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (base == MAP_FAILED)
   {
-    fprintf (stderr, "mem_init_vm: malloc error\n");
+    fprintf (stderr, "mem_init_vm: mmap error: %s\n", strerror (errno));
     exit (1);
   }
 
-  mem_max_addr = mem_start_brk + MAX_HEAP; /* max legal heap address */
-  mem_brk = mem_start_brk;                 /* heap is empty initially */
+  if (mem_hugepages)
+  {
+    /* Trim the reservation to a 2 MB aligned range of mem_max_heap bytes */
+    char *raw = (char *)base;
+    char *aligned = (char *)round_up ((size_t)raw, HUGE_PAGE);
+    if (aligned > raw)
+      munmap (raw, (size_t) (aligned - raw));
+    if (aligned < raw + slop)
+      munmap (aligned + mem_max_heap, (size_t) (raw + slop - aligned));
+    base = aligned;
+    if (madvise (base, mem_max_heap, MADV_HUGEPAGE) < 0)
+      fprintf (stderr, "mem_init_vm: madvise(MADV_HUGEPAGE) failed: %s\n",
+               strerror (errno));
+  }
+
+  mem_start_brk = (char *)base;
+  mem_max_addr = mem_start_brk + mem_max_heap; /* max legal heap address */
+  mem_brk = mem_start_brk;                     /* heap is empty initially */
+  mem_commit_brk = mem_start_brk;              /* nothing committed yet */
 }
 
 /*
@@ -45,7 +120,7 @@ mem_init (void)
 void
 mem_deinit (void)
 {
-  free (mem_start_brk);
+  munmap (mem_start_brk, mem_max_heap);
 }
 
 /*
@@ -54,25 +129,52 @@ mem_deinit (void)
 void
 mem_reset_brk ()
 {
+  if (mem_trim && mem_commit_brk > mem_start_brk)
+    madvise (mem_start_brk, (size_t) (mem_commit_brk - mem_start_brk),
+             MADV_DONTNEED);
   mem_brk = mem_start_brk;
 }
 
+/*
+ * mem_commit - make the heap accessible up to (at least) new_brk
+ */
+static int
+mem_commit (char *new_brk)
+{
+  size_t chunk = mem_hugepages ? HUGE_PAGE : COMMIT_CHUNK;
+  size_t offset = round_up ((size_t) (new_brk - mem_start_brk), chunk);
+  char *new_commit = mem_start_brk + offset;
+  if (new_commit > mem_max_addr)
+    new_commit = mem_max_addr;
+  if (mprotect (mem_commit_brk, (size_t) (new_commit - mem_commit_brk),
+                PROT_READ | PROT_WRITE) < 0)
+    return -1;
+  mem_commit_brk = new_commit;
+  return 0;
+}
+
 /*
  * mem_sbrk - simple model of the sbrk function. Extends the heap
  *    by incr bytes and returns the start address of the new area. In
  *    this model, the heap cannot be shrunk.
  */
 void *
-mem_sbrk (int incr)
+mem_sbrk (intptr_t incr)
 {
   char *old_brk = mem_brk;
 
-  if ((incr < 0) || ((mem_brk + incr) > mem_max_addr))
+  if ((incr < 0) || (incr > mem_max_addr - mem_brk))
   {
     errno = ENOMEM;
     fprintf (stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
     return (void *)-1;
   }
+  if (mem_brk + incr > mem_commit_brk && mem_commit (mem_brk + incr) < 0)
+  {
+    fprintf (stderr, "ERROR: mem_sbrk failed. Could not commit pages: %s\n",
+             strerror (errno));
+    return (void *)-1;
+  }
   mem_brk += incr;
   return (void *)old_brk;
 }
@@ -1,8 +1,12 @@
+#include <stdint.h>
 #include <unistd.h>
 
-void mem_init(void);               
+void mem_set_max_heap(size_t bytes);
+void mem_set_trim(int on);
+void mem_set_hugepages(int on);
+void mem_init(void);
 void mem_deinit(void);
-void *mem_sbrk(int incr);
+void *mem_sbrk(intptr_t incr);
 void mem_reset_brk(void); 
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
@@ -7,6 +7,12 @@
   The size is in words and we are making sure to align on the correct word
   If freeblock found is bigger than the size needed (malloc) split the free block 
   into the size needed and then a free portion afterward. 
+  Small requests are served from per-size-class bins first.
+
+  Compiling with -DMM_DEBUG turns on a memory-tagging debug mode (see the
+  "Debug mode" section below): redzones around every payload, a FIFO
+  quarantine for freed blocks, and a shadow bitmap of poisoned memory.
+  Without MM_DEBUG none of that code is compiled in.
 */
 
 #include <assert.h>
@@ -65,13 +71,13 @@ static inline tag sizeOf (address ptr)
 /* returns footer address given basePtr */
 static inline tag* footer (address ptr)
 {
-  return (tag*) (ptr + (sizeOf(ptr) * WORD_SIZE) - WORD_SIZE);
+  return (tag*) (ptr + ((size_t) sizeOf(ptr) * WORD_SIZE) - WORD_SIZE);
 }
 
 /* gives the basePtr of next block */
 static inline address nextBlock (address ptr)
 {
-  return ptr + (sizeOf(ptr) * WORD_SIZE);
+  return ptr + ((size_t) sizeOf(ptr) * WORD_SIZE);
 }
 
 /* returns the pointer to the prev blocks footer */
@@ -90,7 +96,7 @@ static inline tag* nextHeader (address ptr)
 /* gives the basePtr of prev block*/
 static inline address prevBlock (address ptr)
 {
-  return ptr - (((*prevFooter(ptr) >> 1) << 1) * WORD_SIZE);
+  return ptr - ((size_t) ((*prevFooter(ptr) >> 1) << 1) * WORD_SIZE);
 }
 
 /* basePtr, size, allocated */
@@ -107,29 +113,39 @@ static inline void toggleBlock (address ptr)
   *footer(ptr) ^= 1;
 }
 
+/* Merges a free block with its free neighbours; returns the merged block */
 static inline address coalesce (address ptr)
 {
   /* Get previous and next block allocation status */
   bool prevAlloc = *prevFooter(ptr) & (tag)1; // Can't use prevBlock since dummy footer is of size zero
-  //bool nextAlloc = isAllocated(nextBlock(ptr));
-  if(!prevAlloc && ptr == g_heapBase)
+  bool nextAlloc = *nextHeader(ptr) & (tag)1;
+  tag size = sizeOf(ptr);
+
+  if (!nextAlloc)
+  {
+    size += sizeOf(nextBlock(ptr));
+  }
+  if (!prevAlloc)
   {
-    address prev = prevBlock(ptr);
-    makeBlock(prev, sizeOf(prev) + sizeOf(ptr), false);
-    return prev;
+    ptr = prevBlock(ptr);
+    size += sizeOf(ptr);
   }
+  makeBlock(ptr, size, false);
   return ptr;
 }
 
 /* 
- * Increase heap size by given number of bytes 
+ * Increase heap size by given number of words 
  * Returns base pointer of the new block
  * or NULL if there is an error
  */
 static inline address extendHeap (uint32_t numWords)
 {
-  address ptr = mem_sbrk ((int)numWords * WORD_SIZE);
-  if (ptr == NULL)
+  size_t bytes = (size_t) numWords * WORD_SIZE;
+  if (bytes > INTPTR_MAX)
+    return NULL;
+  address ptr = mem_sbrk ((intptr_t) bytes);
+  if (ptr == (void*) -1)
     return NULL;
 
   makeBlock (ptr, numWords, false);
@@ -140,12 +156,326 @@ static inline address extendHeap (uint32_t numWords)
 /* Calculates number of words needed for proper alignment given a particular size */
 static inline uint32_t align (uint32_t size)
 {
-  uint32_t numWords = size + (2 * TAG_SIZE);
-  numWords = (numWords + (DWORD_SIZE - 1)) / DWORD_SIZE;
-  numWords = numWords * 2;
-  return numWords;
+  /* In size_t so sizes near UINT32_MAX cannot wrap to a tiny block */
+  size_t bytes = (size_t) size + (2 * TAG_SIZE);
+  bytes = (bytes + (DWORD_SIZE - 1)) / DWORD_SIZE;
+  return (uint32_t) (bytes * 2);
+}
+
+/* First free block of at least numWords, or the epilogue if none fits */
+static inline address findFit (uint32_t numWords)
+{
+  address ptr = g_heapBase;
+  while (sizeOf(ptr) != 0 && (isAllocated(ptr) || sizeOf(ptr) < numWords))
+  {
+    ptr = nextBlock(ptr);
+  }
+  return ptr;
+}
+
+/* Finds (or makes) a free block of at least numWords */
+static inline address findOrExtend (uint32_t numWords)
+{
+  address ptr = findFit(numWords);
+  // end of heap reached 
+  if (sizeOf(ptr) == 0)
+    ptr = extendHeap(numWords);
+  return ptr;
+}
+
+/* Allocates the first numWords of free block ptr, freeing the rest */
+static inline void place (address ptr, uint32_t numWords)
+{
+  tag oldSize = sizeOf(ptr);
+  makeBlock(ptr, numWords, true);
+  // size is greater than needed so split block 
+  if (oldSize > numWords)
+    makeBlock(nextBlock(ptr), oldSize - numWords, false);
+}
+
+/* Allocates a block with room for size bytes of payload */
+static inline address allocBlock (uint32_t size)
+{
+  if (size == 0)
+    return NULL;
+
+  uint32_t numWords = align(size);
+  address ptr = findOrExtend(numWords);
+  if (ptr == NULL)
+    return NULL;
+  place(ptr, numWords);
+  return ptr;
+}
+
+/* sets the specified block to not allocated and tries to coalesce with 
+  next and previous blocks to make more free space */
+static inline void freeBlock (address ptr)
+{
+  toggleBlock(ptr);
+  coalesce(ptr);
+}
+
+/****************************************************************/
+// Small size classes
+//
+// Requests of up to SMALL_MAX bytes are rounded up to one of the size
+// classes below. Freed blocks of exactly a class size are kept, still
+// marked allocated, on a per-class LIFO bin (the link lives in the
+// payload), so a small malloc is a table lookup and a bin pop. The
+// request size -> class table is built by the preprocessor.
+
+#ifndef MM_DEBUG
+
+/* Most blocks a bin holds before frees go back to the heap */
+#ifndef BIN_LIMIT
+#define BIN_LIMIT 64
+#endif
+
+/* Size classes as whole block sizes in bytes (header and footer
+   included), so a class holds block - WORD_SIZE bytes of payload */
+#define SIZE_CLASSES(X, arg)                                    \
+  X(16, arg)   X(32, arg)   X(48, arg)   X(64, arg)             \
+  X(80, arg)   X(96, arg)   X(112, arg)  X(128, arg)            \
+  X(160, arg)  X(192, arg)  X(224, arg)  X(256, arg)            \
+  X(320, arg)  X(384, arg)  X(448, arg)  X(512, arg)            \
+  X(640, arg)  X(768, arg)  X(896, arg)  X(1024, arg)           \
+  X(1280, arg) X(1536, arg) X(1792, arg) X(2048, arg)           \
+  X(2560, arg) X(3072, arg) X(3584, arg) X(4096, arg)
+
+/* Largest request served from the bins: the payload of the last class */
+#define SMALL_MAX (4096 - 8)
+
+#define CLASS_BLOCK_ENTRY(block, unused) block,
+#define COUNT_BELOW(block, b) + ((b) > (block) - 8)
+#define NUM_CLASSES (0 SIZE_CLASSES(COUNT_BELOW, SMALL_MAX) + 1)
+
+/* Index of the smallest class whose payload holds b bytes */
+#define CLASS_OF(b) (0 SIZE_CLASSES(COUNT_BELOW, b))
+
+/* One table entry per 8 bytes of request, 0 .. SMALL_MAX */
+#define T1(g)   CLASS_OF((g) * 8),
+#define T4(g)   T1(g) T1((g) + 1) T1((g) + 2) T1((g) + 3)
+#define T16(g)  T4(g) T4((g) + 4) T4((g) + 8) T4((g) + 12)
+#define T64(g)  T16(g) T16((g) + 16) T16((g) + 32) T16((g) + 48)
+#define T256(g) T64(g) T64((g) + 64) T64((g) + 128) T64((g) + 192)
+
+static const uint32_t CLASS_BLOCK[] = { SIZE_CLASSES(CLASS_BLOCK_ENTRY, 0) };
+
+/* SIZE_CLASS[(size + 7) / 8] is the class of a size byte request */
+static const uint8_t SIZE_CLASS[SMALL_MAX / 8 + 1] = {
+  T256(0) T64(256) T64(320) T64(384) T16(448) T16(464) T16(480) T4(496)
+  T4(500) T4(504) T1(508) T1(509) T1(510) T1(511)
+};
+
+static address  g_bins[NUM_CLASSES];
+static uint32_t g_binCount[NUM_CLASSES];
+
+/* Pops a block off the bin for class cls, or returns NULL */
+static inline address binPop (uint8_t cls)
+{
+  address ptr = g_bins[cls];
+  if (ptr != NULL)
+  {
+    g_bins[cls] = *(address*) ptr;
+    --g_binCount[cls];
+  }
+  return ptr;
+}
+
+/* Pushes an allocated block onto its class bin if it is exactly a class
+   size and the bin has room; returns false if the block was not taken */
+static inline bool binPush (address ptr)
+{
+  size_t block = (size_t) sizeOf(ptr) * WORD_SIZE;
+  if (block > SMALL_MAX + WORD_SIZE)
+    return false;
+  uint8_t cls = SIZE_CLASS[(block - WORD_SIZE) / 8];
+  if (CLASS_BLOCK[cls] != block || g_binCount[cls] == BIN_LIMIT)
+    return false;
+  *(address*) ptr = g_bins[cls];
+  g_bins[cls] = ptr;
+  ++g_binCount[cls];
+  return true;
+}
+
+/* Payload size of the class serving a request (requests that are not
+   small are returned unchanged) */
+static inline uint32_t classRound (uint32_t size)
+{
+  return size - 1 < SMALL_MAX
+    ? CLASS_BLOCK[SIZE_CLASS[(size + 7) / 8]] - WORD_SIZE
+    : size;
+}
+
+static void binsInit (void)
+{
+  memset (g_bins, 0, sizeof (g_bins));
+  memset (g_binCount, 0, sizeof (g_binCount));
+}
+
+#endif /* !MM_DEBUG */
+
+/****************************************************************/
+// Debug mode
+//
+// Each payload handed out is laid out as
+//
+//   [front redzone][user bytes][rear redzone]
+//
+// The first 4 bytes of the front redzone hold the requested size, the
+// rest of both redzones is filled with REDZONE_BYTE and checked on free.
+// Freed payloads are filled with POISON_BYTE and parked in a FIFO
+// quarantine; when a block leaves the quarantine the poison is checked
+// again (catching writes after free) before the block is really freed.
+// The shadow bitmap has one bit per ALIGNMENT-byte granule of the heap
+// and is set for redzones and quarantined payloads, so double frees,
+// bad frees and overlapping allocations are caught immediately.
+
+#ifdef MM_DEBUG
+
+/* Redzone size in bytes on each side; must be a multiple of ALIGNMENT */
+#ifndef MM_REDZONE
+#define MM_REDZONE 16
+#endif
+
+/* Number of freed blocks held back before they can be reused */
+#ifndef MM_QUARANTINE
+#define MM_QUARANTINE 64
+#endif
+
+#define REDZONE_BYTE 0xFA
+#define POISON_BYTE  0xFD
+#define GRANULE      16
+
+static address g_quarantine[MM_QUARANTINE];
+static uint32_t g_quarHead;
+static uint32_t g_quarCount;
+
+static uint8_t* g_shadow;
+static size_t   g_shadowBytes;
+
+/* Reports a detected error and stops so the heap can be inspected */
+static void debugFail (const char* what, address user)
+{
+  fprintf (stderr, "mm_debug: %s (payload %p)\n", what, (void*) user);
+  abort ();
+}
+
+/* Rounds a byte count up to a whole number of granules */
+static inline size_t granuleRound (size_t bytes)
+{
+  return (bytes + (GRANULE - 1)) & ~(size_t) (GRANULE - 1);
+}
+
+/* Index of the granule holding ptr */
+static inline size_t granuleOf (address ptr)
+{
+  return (size_t) (ptr - (address) mem_heap_lo ()) / GRANULE;
+}
+
+/* Grows the shadow bitmap so it covers granule index last */
+static void shadowReserve (size_t last)
+{
+  size_t needed = last / 8 + 1;
+  if (needed <= g_shadowBytes)
+    return;
+  size_t newBytes = g_shadowBytes ? g_shadowBytes : 4096;
+  while (newBytes < needed)
+    newBytes *= 2;
+  uint8_t* grown = realloc (g_shadow, newBytes);
+  if (grown == NULL)
+  {
+    fprintf (stderr, "mm_debug: cannot grow shadow bitmap\n");
+    abort ();
+  }
+  memset (grown + g_shadowBytes, 0, newBytes - g_shadowBytes);
+  g_shadow = grown;
+  g_shadowBytes = newBytes;
+}
+
+/* Sets or clears the shadow bits of every granule in [ptr, ptr + len) */
+static void shadowMark (address ptr, size_t len, bool poisoned)
+{
+  if (len == 0)
+    return;
+  size_t first = granuleOf (ptr);
+  size_t last = granuleOf (ptr + len - 1);
+  shadowReserve (last);
+  for (size_t g = first; g <= last; ++g)
+  {
+    if (poisoned)
+      g_shadow[g / 8] |= (uint8_t) (1u << (g % 8));
+    else
+      g_shadow[g / 8] &= (uint8_t) ~(1u << (g % 8));
+  }
+}
+
+/* Returns true if any granule in [ptr, ptr + len) is poisoned */
+static bool shadowPoisoned (address ptr, size_t len)
+{
+  if (len == 0)
+    return false;
+  size_t first = granuleOf (ptr);
+  size_t last = granuleOf (ptr + len - 1);
+  for (size_t g = first; g <= last && g / 8 < g_shadowBytes; ++g)
+  {
+    if (g_shadow[g / 8] & (1u << (g % 8)))
+      return true;
+  }
+  return false;
 }
 
+/* Returns true if every byte in [ptr, ptr + len) equals value */
+static bool bytesAre (address ptr, size_t len, byte value)
+{
+  for (size_t i = 0; i < len; ++i)
+  {
+    if (ptr[i] != value)
+      return false;
+  }
+  return true;
+}
+
+/* Requested size stored at the start of the front redzone */
+static inline uint32_t* requestedSize (address user)
+{
+  return (uint32_t*) (user - MM_REDZONE);
+}
+
+/* Rear redzone spans from the end of the user bytes to the next
+   granule boundary plus MM_REDZONE */
+static inline size_t rearRedzone (uint32_t size)
+{
+  return granuleRound (size) - size + MM_REDZONE;
+}
+
+/* Verifies the poison of a quarantined block and hands it back */
+static void releaseQuarantined (address user)
+{
+  uint32_t size = *requestedSize (user);
+  if (!bytesAre (user, granuleRound (size), POISON_BYTE))
+    debugFail ("write after free", user);
+  shadowMark (user - MM_REDZONE, granuleRound (size) + 2 * MM_REDZONE, false);
+  freeBlock (user - MM_REDZONE);
+}
+
+static void debugInit (void)
+{
+  g_quarHead = 0;
+  g_quarCount = 0;
+  if (g_shadow != NULL)
+    memset (g_shadow, 0, g_shadowBytes);
+}
+
+/* Returns 0 if [ptr, ptr + len) touches no redzone or freed payload */
+int
+mm_debug_check_access (const void* ptr, size_t len)
+{
+  return shadowPoisoned ((address) ptr, len) ? -1 : 0;
+}
+
+#endif /* MM_DEBUG */
+
 /****************************************************************/
 // Non-inline functions
 
@@ -153,84 +483,51 @@ int
 mm_init (void)
 {
   address ptr = mem_sbrk (4 * DWORD_SIZE);
-  if (ptr == NULL)
+  if (ptr == (void*) -1)
     return -1;
   
   g_heapBase = ptr + ALIGNMENT; // Moves base pointer to double word alignment
   
   /* Create dummy header and footer */
   *prevFooter(g_heapBase) = (0 | true);
+  makeBlock(g_heapBase, 6, 0);
   *nextHeader(g_heapBase) = (0 | true);
 
-  makeBlock(g_heapBase, 6, 0);
+#ifdef MM_DEBUG
+  debugInit ();
+#else
+  binsInit ();
+#endif
 
   return 0;
 }
 
 /****************************************************************/
 
+#ifndef MM_DEBUG
+
 void*
 mm_malloc (uint32_t size)
 {
-  address ptr = g_heapBase;
-  uint32_t numWords = align(size);
-
-  if (size == 0)
-    return NULL;
-  // loop through heap
-  for (address ptr = g_heapBase; sizeOf(ptr) == 0; ptr = nextBlock(ptr))
+  /* Fast path: 1 <= size <= SMALL_MAX */
+  if (size - 1 < SMALL_MAX)
   {
-    //if allocated or too small continue looking
-    if (isAllocated(ptr))
-    {
-      continue;
-    }
-    // still not big enough
-    else if (sizeOf(ptr) < numWords)
-    {
-      continue;
-    }
-    //found adequate block
-    else if (sizeOf(ptr) == size)
-    {
-      makeBlock(ptr, numWords, true);
-      return ptr;
-    }
-    // size is greater than curr block so split block 
-    else if (sizeOf(ptr) > size)
-    {
-      tag oldSize = sizeOf(ptr);
-      makeBlock(ptr, numWords, true);
-      makeBlock(nextBlock(ptr), oldSize - numWords, false);
+    uint8_t cls = SIZE_CLASS[(size + 7) / 8];
+    address ptr = binPop (cls);
+    if (ptr != NULL)
       return ptr;
-    }
-  }
-  // end of heap reached 
-  ptr = extendHeap(numWords);
-  tag ptrSize = sizeOf(ptr);
-  //if extended heap matches required size then place it 
-  if (ptrSize == numWords)
-  {
-    makeBlock(ptr, numWords, true);
+    return allocBlock (CLASS_BLOCK[cls] - WORD_SIZE);
   }
-  // place the block and if extra space, free the rest
-  else
-  {
-    makeBlock(ptr, numWords, true);
-    makeBlock(nextBlock(ptr), ptrSize - numWords, false);
-  }
-  return ptr;
+  return allocBlock (size);
 }
 
 /****************************************************************/
 
-/* sets the specified block to not allocated and tries to coalesce with 
-  next and previous blocks to make more free space */
 void
 mm_free (void *ptr)
 {
-  toggleBlock(ptr);
-  coalesce(ptr);
+  if (!binPush (ptr))
+    freeBlock (ptr);
 }
 
 /****************************************************************/
@@ -251,11 +548,218 @@ mm_realloc (void *ptr, uint32_t size)
   }
 
   address tempPtr = mm_malloc(size);
-  tempPtr = memcpy(tempPtr, ptr, sizeOf(ptr) * WORD_SIZE - WORD_SIZE);
+  if (tempPtr == NULL)
+    return NULL;
+  size_t oldSize = (size_t) sizeOf(ptr) * WORD_SIZE - WORD_SIZE;
+  tempPtr = memcpy(tempPtr, ptr, oldSize < size ? oldSize : size);
   mm_free(ptr);
   return tempPtr;
 }
 
+/****************************************************************/
+
+/* Allocates count blocks of size bytes with a single search: blocks are
+   popped off the size class bin first, then one free block big enough
+   for the rest is found (or the heap extended) and split front to back.
+   Returns count, or 0 if nothing was allocated */
+uint32_t
+mm_malloc_batch (uint32_t size, uint32_t count, void **ptrs)
+{
+  if (size == 0 || count == 0)
+    return 0;
+
+  uint32_t done = 0;
+  if (size <= SMALL_MAX)
+  {
+    uint8_t cls = SIZE_CLASS[(size + 7) / 8];
+    address ptr;
+    while (done < count && (ptr = binPop(cls)) != NULL)
+      ptrs[done++] = ptr;
+  }
+  if (done == count)
+    return count;
+
+  /* Small blocks get class sizes so they can be binned when freed */
+  uint32_t numWords = align(classRound(size));
+  uint32_t rest = count - done;
+  /* The whole run must fit in one block's size field, and its byte
+     size in what mem_sbrk can extend the heap by */
+  if (numWords > UINT32_MAX / rest
+      || (size_t) numWords * rest > (size_t) INTPTR_MAX / WORD_SIZE)
+  {
+    mm_free_batch(ptrs, done);
+    return 0;
+  }
+  address ptr = findOrExtend(numWords * rest);
+  if (ptr == NULL)
+  {
+    mm_free_batch(ptrs, done);
+    return 0;
+  }
+
+  tag total = sizeOf(ptr);
+  for (uint32_t i = done; i < count; ++i)
+  {
+    makeBlock(ptr, numWords, true);
+    ptrs[i] = ptr;
+    ptr = nextBlock(ptr);
+  }
+  if (total > numWords * rest)
+    makeBlock(ptr, total - numWords * rest, false);
+  return count;
+}
+
+/****************************************************************/
+
+/* Orders block pointers by address for qsort */
+static int compareAddress (const void* a, const void* b)
+{
+  address x = *(address const*) a;
+  address y = *(address const*) b;
+  return (x > y) - (x < y);
+}
+
+/* Frees count blocks at once. Blocks that fit a bin are binned; the
+   rest are sorted by address (ptrs is reordered) so runs of neighbouring
+   blocks are merged into one free block and coalesced with the rest of
+   the heap only once */
+void
+mm_free_batch (void **ptrs, uint32_t count)
+{
+  uint32_t kept = 0;
+  for (uint32_t i = 0; i < count; ++i)
+  {
+    if (!binPush(ptrs[i]))
+      ptrs[kept++] = ptrs[i];
+  }
+  count = kept;
+  qsort(ptrs, count, sizeof(void*), compareAddress);
+
+  uint32_t i = 0;
+  while (i < count)
+  {
+    address start = ptrs[i++];
+    tag size = sizeOf(start);
+    address end = nextBlock(start);
+    while (i < count && ptrs[i] == end)
+    {
+      size += sizeOf(end);
+      end = nextBlock(end);
+      ++i;
+    }
+    makeBlock(start, size, false);
+    coalesce(start);
+  }
+}
+
+#else /* MM_DEBUG */
+
+void*
+mm_malloc (uint32_t size)
+{
+  if (size == 0)
+    return NULL;
+
+  size_t total = granuleRound (size) + 2 * MM_REDZONE;
+  address base = allocBlock ((uint32_t) total);
+  if (base == NULL)
+    return NULL;
+  if (shadowPoisoned (base, total))
+    debugFail ("allocator returned a redzone or quarantined block",
+               base + MM_REDZONE);
+
+  address user = base + MM_REDZONE;
+  memset (base, REDZONE_BYTE, MM_REDZONE);
+  *requestedSize (user) = size;
+  memset (user + size, REDZONE_BYTE, rearRedzone (size));
+  shadowMark (base, MM_REDZONE, true);
+  shadowMark (user + granuleRound (size), MM_REDZONE, true);
+  return user;
+}
+
+/****************************************************************/
+
+void
+mm_free (void *ptr)
+{
+  address user = ptr;
+  if (!shadowPoisoned (user - MM_REDZONE, 1))
+    debugFail ("free of a pointer not returned by mm_malloc", user);
+  if (shadowPoisoned (user, 1))
+    debugFail ("double free", user);
+
+  uint32_t size = *requestedSize (user);
+  address front = user - MM_REDZONE + sizeof (uint32_t);
+  if (!bytesAre (front, MM_REDZONE - sizeof (uint32_t), REDZONE_BYTE))
+    debugFail ("front redzone overwritten", user);
+  if (!bytesAre (user + size, rearRedzone (size), REDZONE_BYTE))
+    debugFail ("rear redzone overwritten", user);
+
+  memset (user, POISON_BYTE, granuleRound (size));
+  shadowMark (user, granuleRound (size), true);
+
+  if (g_quarCount == MM_QUARANTINE)
+  {
+    releaseQuarantined (g_quarantine[g_quarHead]);
+    g_quarHead = (g_quarHead + 1) % MM_QUARANTINE;
+    --g_quarCount;
+  }
+  g_quarantine[(g_quarHead + g_quarCount) % MM_QUARANTINE] = user;
+  ++g_quarCount;
+}
+
+/****************************************************************/
+
+void*
+mm_realloc (void *ptr, uint32_t size)
+{
+  if (ptr == NULL)
+    return mm_malloc (size);
+
+  if (size == 0)
+  {
+    mm_free (ptr);
+    return NULL;
+  }
+
+  address newPtr = mm_malloc (size);
+  if (newPtr == NULL)
+    return NULL;
+  uint32_t oldSize = *requestedSize (ptr);
+  memcpy (newPtr, ptr, oldSize < size ? oldSize : size);
+  mm_free (ptr);
+  return newPtr;
+}
+
+/****************************************************************/
+
+/* Batches go through the checked entry points one block at a time */
+uint32_t
+mm_malloc_batch (uint32_t size, uint32_t count, void **ptrs)
+{
+  for (uint32_t i = 0; i < count; ++i)
+  {
+    if ((ptrs[i] = mm_malloc (size)) == NULL)
+    {
+      while (i > 0)
+        mm_free (ptrs[--i]);
+      return 0;
+    }
+  }
+  return count;
+}
+
+/****************************************************************/
+
+void
+mm_free_batch (void **ptrs, uint32_t count)
+{
+  for (uint32_t i = 0; i < count; ++i)
+    mm_free (ptrs[i]);
+}
+
+#endif /* MM_DEBUG */
+
 void
 printBlock (address ptr)
 {
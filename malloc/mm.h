@@ -5,3 +5,10 @@ extern int mm_init (void);
 extern void *mm_malloc (uint32_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, uint32_t size);
+extern uint32_t mm_malloc_batch (uint32_t size, uint32_t count, void **ptrs);
+extern void mm_free_batch (void **ptrs, uint32_t count);
+
+#ifdef MM_DEBUG
+/* Returns 0 if [ptr, ptr + len) lies outside every redzone and freed block */
+extern int mm_debug_check_access (const void *ptr, size_t len);
+#endif
@@ -1,5 +1,8 @@
 /* Implementation of simple command-line interface */
 
+/* For accept4 and fopencookie */
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,8 +13,15 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/select.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <fcntl.h>
 #include <ctype.h>
+#include <errno.h>
+#include <signal.h>
 
 #include "report.h"
 #include "console.h"
@@ -19,6 +29,11 @@
 
 /* Some global values */
 static cmd_ptr cmd_list = NULL;
+
+/* Hash table of commands, chained through hash_next */
+#define CMD_HASH 128
+static cmd_ptr cmd_table[CMD_HASH];
+
 static param_ptr param_list = NULL;
 static bool block_flag = false;
 static bool prompt_flag = true;
@@ -26,28 +41,42 @@ static bool prompt_flag = true;
 /* Am I timing a command that has the console blocked? */
 static bool block_timing = false;
 
-/* Time of day */
-static double first_time;
-static double last_time;
+/* Usage at start, and when last reported by time */
+static usage_t first_usage;
+static usage_t last_usage;
 
 /*
   Implement buffered I/O using variant of RIO package from CS:APP
   Must create stack of buffers to handle I/O with nested source commands.
+
+  Regular files are mapped into memory whole (privately, so that lines
+  can be split in place) and walked without copying.  Other input is read
+  into a buffer.  Either way, lines are found with memchr, and the end of
+  the next line is remembered between read_ready and readline.
 */
 
-#define RIO_BUFSIZE 8192
+#define RIO_BUFSIZE 65536
+/* Longest command line.  The rest of a longer line is dropped */
+#define MAXLINE (RIO_BUFSIZE - 1)
 typedef struct RIO_ELE rio_t, *rio_ptr;
 
 struct RIO_ELE {
     int fd;                /* File descriptor */
-    int cnt;               /* Unread bytes in internal buffer */
-    char *bufptr;          /* Next unread byte in internal buffer */
-    char buf[RIO_BUFSIZE]; /* Internal buffer */
+    size_t cnt;            /* Unread bytes in internal buffer or mapping */
+    char *bufptr;          /* Next unread byte */
+    char *eol;             /* Newline ending next line, if already found */
+    char *map;             /* Mapped file, or NULL when reading into buf */
+    size_t map_len;
+    bool skip;             /* Dropping the rest of an overlong line */
+    bool timed;            /* Report usage when done, since time_start */
+    usage_t time_start;
+    char buf[RIO_BUFSIZE + 1]; /* Internal buffer, with room for a '\0' */
     rio_ptr prev;          /* Next element in stack */
 };
 
 rio_ptr buf_stack;
-char linebuf[RIO_BUFSIZE];
+/* Holds a final line that has no newline in a mapped file */
+static char linebuf[MAXLINE + 1];
 
 /* Maximum file descriptor */
 int fd_max = 0;
@@ -76,6 +105,9 @@ bool do_source_cmd(int argc, char *argv[]);
 bool do_log_cmd(int argc, char *argv[]);
 bool do_time_cmd(int argc, char *argv[]);
 bool do_comment_cmd(int argc, char *argv[]);
+bool do_binlog_cmd(int argc, char *argv[]);
+bool do_dump_cmd(int argc, char *argv[]);
+bool do_mem_cmd(int argc, char *argv[]);
 
 static void init_in();
 
@@ -87,6 +119,7 @@ static bool interpret_cmda(int argc, char *argv[]);
 /* Initialize interpreter */
 void init_cmd() {
     cmd_list = NULL;
+    memset(cmd_table, 0, sizeof(cmd_table));
     param_list = NULL;
     err_cnt = 0;
     quit_flag = false;
@@ -98,6 +131,12 @@ void init_cmd() {
     add_cmd("log", do_log_cmd,         " file           | Copy output to file");
     add_cmd("time", do_time_cmd,       " cmd arg ...    | Time command execution");
     add_cmd("#", do_comment_cmd,       " ...            | Display comment");
+    add_cmd("binlog", do_binlog_cmd,
+	    " [file|-|off] [n] | Record output unformatted in ring of n entries, copied to file");
+    add_cmd("mem", do_mem_cmd,
+	    " [n [key]]      | Show top n allocation sites by bytes, count, peak, or time");
+    add_cmd("dump", do_dump_cmd,
+	    " [-c] [n|file]  | Format last n binary records, or a binary log file (-c: check only)");
     add_param("verbose", &verblevel, "Verbosity level", NULL);
     add_param("error", &err_limit,   "Number of errors until exit", NULL);
     add_param("echo", &echo, "Do/don't echo commands", NULL);
@@ -107,8 +146,18 @@ void init_cmd() {
 	      change_timeout);
 #endif
     init_in();
-    init_time(&last_time);
-    first_time = last_time;
+    sample_usage(&first_usage);
+    last_usage = first_usage;
+}
+
+/* Bucket of command name (FNV-1a hash) */
+static unsigned cmd_hash(const char *name) {
+    unsigned h = 2166136261u;
+    while (*name) {
+	h ^= (unsigned char) *name++;
+	h *= 16777619u;
+    }
+    return h & (CMD_HASH - 1);
 }
 
 /* Add a new command */
@@ -122,9 +171,30 @@ void add_cmd(char *name, cmd_function operation, char *documentation) {
     cmd_ptr ele = (cmd_ptr) malloc_or_fail(sizeof(cmd_ele), "add_cmd");
     ele->name = name;
     ele->operation = operation;
+    ele->int_operation = NULL;
     ele->documentation = documentation;
     ele->next = next_cmd;
     *last_loc = ele;
+    unsigned h = cmd_hash(name);
+    ele->hash_next = cmd_table[h];
+    cmd_table[h] = ele;
+}
+
+/* Find command by name.  Return NULL if there is none */
+static cmd_ptr find_cmd(char *name) {
+    cmd_ptr c = cmd_table[cmd_hash(name)];
+    while (c && strcmp(name, c->name) != 0)
+	c = c->hash_next;
+    return c;
+}
+
+/* Give existing command an integer entry point */
+void add_int_cmd(char *name, int_cmd_function operation) {
+    cmd_ptr c = find_cmd(name);
+    if (c)
+	c->int_operation = operation;
+    else
+	report_event(MSG_FATAL, "No command '%s' for integer entry point", name);
 }
 
 /* Add a new parameter */
@@ -146,54 +216,54 @@ void add_param(char *name, int *valp, char *documentation,
 }
 
 
-/* Parse a string into a command line */
-char **parse_args(char *line, int *argcp) {
-    /*
-      Must first determine how many arguments there are.
-      Replace all white space with null characters
-    */
-    size_t len = strlen(line);
-    /* First copy into buffer with each substring null-terminated */
-    char *buf = malloc_or_fail(len+1, "parse_args");
-    char *src = line;
-    char *dst = buf;
-    bool skipping = true;
-    int c;
+/*
+  Arguments of the command being interpreted point into its command
+  line.  A line of MAXLINE characters has at most MAXLINE/2 + 1 words;
+  longer lines given some other way are rejected if they have more.
+*/
+#define MAXARGS (MAXLINE / 2 + 1)
+static char *arg_buf[MAXARGS];
+
+/*
+  Split line in place into words, by writing a null character after
+  each one, and store pointers to them in argv.  Return number of words,
+  or -1 if there are more than maxargs
+*/
+static int parse_args(char *line, char **argv, int maxargs) {
     int argc = 0;
-    while ((c = *src++) != '\0') {
-	if (isspace(c)) {
-	    if (!skipping) {
-		/* Hit end of word */
-		*dst++ = '\0';
-		skipping = true;
-	    }
-	} else {
-	    if (skipping) {
-		/* Hit start of new word */
-		argc++;
-		skipping = false;
-	    }
-	    *dst++ = c;
-	}
-    }
-    /* Now assemble into array of strings */
-    char **argv = calloc_or_fail(argc, sizeof(char *), "parse_args");
-    size_t i;
-    src = buf;
-    for (i = 0; i < argc; i++) {
-	argv[i] = strsave_or_fail(src, "parse_args");
-	src += strlen(argv[i])+1;
+    char *src = line;
+    while (argc < maxargs) {
+	while (isspace((unsigned char) *src))
+	    src++;
+	if (*src == '\0')
+	    break;
+	argv[argc++] = src;
+	while (*src != '\0' && !isspace((unsigned char) *src))
+	    src++;
+	if (*src == '\0')
+	    break;
+	*src++ = '\0';
     }
-    free_block(buf, len+1);
-    *argcp = argc;
-    return argv;
+    while (isspace((unsigned char) *src))
+	src++;
+    return *src == '\0' ? argc : -1;
 }
 
+/* Service client whose command is being interpreted, if any */
+typedef struct CLIENT client_t;
+static client_t *active_client = NULL;
+static client_t *stdin_client = NULL;
+static void close_active_client();
+
 void record_error() {
     err_cnt++;
     if (err_cnt >= err_limit) {
 	report(1, "Error limit exceeded.  Stopping command execution");
-	quit_flag = true;
+	/* A client exceeding its limit only loses its own connection */
+	if (active_client)
+	    close_active_client();
+	else
+	    quit_flag = true;
     }
 }
 
@@ -202,10 +272,8 @@ static bool interpret_cmda(int argc, char *argv[]) {
     if (argc == 0)
 	return true;
     /* Try to find matching command */
-    cmd_ptr next_cmd = cmd_list;
+    cmd_ptr next_cmd = find_cmd(argv[0]);
     bool ok = true;
-    while (next_cmd && strcmp(argv[0], next_cmd->name) != 0)
-	next_cmd = next_cmd->next;
     if (next_cmd) {
 	ok = next_cmd->operation(argc, argv);
 	if (!ok)
@@ -218,21 +286,23 @@ static bool interpret_cmda(int argc, char *argv[]) {
     return ok;
 }
 
-/* Execute a command from a command line */
+/*
+  Execute a command from a command line.
+  The line is split in place, so it must be writable
+*/
 bool interpret_cmd(char *cmdline) {
-    int argc;
     if (quit_flag)
 	return false;
 #if RPT >= 6
     report(6, "Interpreting command '%s'\n", cmdline);
 #endif
-    char **argv = parse_args(cmdline, &argc);
-    bool ok = interpret_cmda(argc, argv);
-    int i;
-    for (i = 0; i < argc; i++)
-	free_string(argv[i]);
-    free_array(argv, argc, sizeof(char *));
-    return ok;
+    int argc = parse_args(cmdline, arg_buf, MAXARGS);
+    if (argc < 0) {
+	report(1, "Command has more than %d words", MAXARGS);
+	record_error();
+	return false;
+    }
+    return interpret_cmda(argc, arg_buf);
 }
 
 /* Set function to be executed as part of program exit */
@@ -258,11 +328,23 @@ void set_echo(bool on) {
 bool do_quit_cmd(int argc, char *argv[]) {
     cmd_ptr c = cmd_list;
     bool ok = true;
+    /* Socket clients only end their own session */
+    if (active_client && active_client != stdin_client) {
+	close_active_client();
+	return true;
+    }
+    /* Before popping the input, which argv may point into */
+    int i;
+    for (i = 0; i < quit_helper_cnt; i++) {
+	ok = ok && quit_helpers[i](argc, argv);
+    }
     while (c) {
 	cmd_ptr ele = c;
 	c = c->next;
 	free_block(ele, sizeof(cmd_ele));
     }
+    cmd_list = NULL;
+    memset(cmd_table, 0, sizeof(cmd_table));
     param_ptr p = param_list;
     while (p) {
 	param_ptr ele = p;
@@ -271,10 +353,7 @@ bool do_quit_cmd(int argc, char *argv[]) {
     }
     while (buf_stack)
 	pop_file();
-    int i;
-    for (i = 0; i < quit_helper_cnt; i++) {
-	ok = ok && quit_helpers[i](argc, argv);
-    }
+    binlog_stop();
     quit_flag = true;
     return ok;
 }
@@ -363,11 +442,17 @@ bool do_option_cmd(int argc, char *argv[]) {
     return true;
 }
 
+static bool is_compiled(char *fname);
+static bool run_compiled(char *fname);
+static void drain_files(rio_ptr base);
+
 bool do_source_cmd(int argc, char *argv[]) {
     if (argc < 2) {
 	report(1, "No source file given");
 	return false;
     }
+    if (is_compiled(argv[1]))
+	return run_compiled(argv[1]);
     if (!push_file(argv[1])) {
 	report(1, "Could not open source file '%s'", argv[1]);
 	return false;
@@ -387,19 +472,111 @@ bool do_log_cmd(int argc, char *argv[]) {
     return result;
 }
 
+/* Default number of records kept by binlog */
+#define BINLOG_RECORDS 65536
+
+bool do_binlog_cmd(int argc, char *argv[]) {
+    int records = BINLOG_RECORDS;
+    char *fname = argc > 1 ? argv[1] : "-";
+    if (strcmp(fname, "off") == 0) {
+	binlog_stop();
+	return true;
+    }
+    if (argc > 2 && (!get_int(argv[2], &records) || records < 1)) {
+	report(1, "Invalid number of records '%s'", argv[2]);
+	return false;
+    }
+    if (!binlog_start(strcmp(fname, "-") == 0 ? NULL : fname, records)) {
+	report(1, "Couldn't start binary log '%s'", fname);
+	return false;
+    }
+    return true;
+}
+
+bool do_dump_cmd(int argc, char *argv[]) {
+    int n = 0;
+    bool show = true;
+    if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+	show = false;
+	argc--;
+	argv++;
+    }
+    if (argc > 1 && !get_int(argv[1], &n)) {
+	if (!binlog_dump_file(argv[1], show)) {
+	    report(1, "ERROR: Couldn't read all of binary log '%s'", argv[1]);
+	    return false;
+	}
+	return true;
+    }
+    long got = binlog_dump(n > 0 ? n : 0, show);
+    if (got < 0) {
+	/* Shown even while recording */
+	report_event(MSG_ERROR, "Damaged record in binary log");
+	return false;
+    }
+    if (n > 0 && got < n) {
+	report_event(MSG_ERROR, "Only %ld of %d records in binary log", got, n);
+	return false;
+    }
+    return true;
+}
+
+bool do_mem_cmd(int argc, char *argv[]) {
+    static char *keys[] = { "bytes", "count", "peak", "time" };
+    int n = 10;
+    int k = SITE_BYTES;
+    if (argc > 1 && !get_int(argv[1], &n)) {
+	report(1, "Invalid number of sites '%s'", argv[1]);
+	return false;
+    }
+    if (argc > 2) {
+	for (k = 0; k <= SITE_TIME && strcmp(argv[2], keys[k]) != 0; k++)
+	    ;
+	if (k > SITE_TIME) {
+	    report(1, "Unknown key '%s'.  Use bytes, count, peak, or time",
+		   argv[2]);
+	    return false;
+	}
+    }
+    mem_sites(n, k);
+    return true;
+}
+
+/* Report usage since start, labeled, and remember it as the last report */
+static void report_usage(usage_t *start, char *label) {
+    usage_t now;
+    sample_usage(&now);
+    report(1, "%s time = %.3f, CPU = %.3f, RSS = %lu KB (%+ld KB)", label,
+	   now.wall - start->wall, now.cpu - start->cpu,
+	   (unsigned long) (now.rss >> 10),
+	   ((long) now.rss - (long) start->rss) / 1024);
+    last_usage = now;
+}
+
 bool do_time_cmd(int argc, char *argv[]) {
-    double delta = delta_time(&last_time);
     bool ok = true;
     if (argc <= 1) {
-	double elapsed = last_time - first_time;
-	report(1, "Elapsed time = %.3f, Delta time = %.3f", elapsed, delta);
+	usage_t now;
+	sample_usage(&now);
+	report(1, "Elapsed time = %.3f, CPU = %.3f, RSS = %lu KB (%+ld KB)",
+	       now.wall - first_usage.wall, now.cpu - first_usage.cpu,
+	       (unsigned long) (now.rss >> 10),
+	       ((long) now.rss - (long) first_usage.rss) / 1024);
+	report_usage(&last_usage, "Delta");
     } else {
+	usage_t start;
+	rio_ptr before = buf_stack;
+	sample_usage(&start);
 	ok = interpret_cmda(argc-1, argv+1);
 	if (block_flag) {
 	    block_timing = true;
+	    last_usage = start;
+	} else if (buf_stack && buf_stack != before && buf_stack->prev == before) {
+	    /* Command sourced a file.  Report when it is done */
+	    buf_stack->timed = true;
+	    buf_stack->time_start = start;
 	} else {
-	    delta = delta_time(&last_time);
-	    report(1, "Delta time = %.3f", delta);
+	    report_usage(&start, "Delta");
 	}
     }
     return ok;
@@ -419,6 +596,23 @@ static bool push_file(char *fname) {
     rnew->fd = fd;
     rnew->cnt = 0;
     rnew->bufptr = rnew->buf;
+    rnew->eol = NULL;
+    rnew->map = NULL;
+    rnew->map_len = 0;
+    rnew->skip = false;
+    rnew->timed = false;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+	char *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE, fd, 0);
+	if (map != MAP_FAILED) {
+	    madvise(map, st.st_size, MADV_SEQUENTIAL);
+	    rnew->map = map;
+	    rnew->map_len = st.st_size;
+	    rnew->bufptr = map;
+	    rnew->cnt = st.st_size;
+	}
+    }
     rnew->prev = buf_stack;
     buf_stack = rnew;
     return true;
@@ -431,6 +625,10 @@ static void pop_file() {
     if (buf_stack) {
 	rio_ptr rsave = buf_stack;
 	buf_stack = rsave->prev;
+	if (rsave->timed)
+	    report_usage(&rsave->time_start, "Trace");
+	if (rsave->map)
+	    munmap(rsave->map, rsave->map_len);
 	close(rsave->fd);
 	free_block(rsave, sizeof(rio_t));
     }
@@ -442,56 +640,108 @@ static void init_in() {
     buf_stack = NULL;
 }
 
+/* Does the input buffer hold a complete line?  Remembers where it ends */
+static bool find_eol(rio_ptr r) {
+    if (!r->eol && r->cnt > 0)
+	r->eol = memchr(r->bufptr, '\n', r->cnt);
+    return r->eol != NULL;
+}
+
+/* Take the next len bytes of input as a line, terminating it in place */
+static char *take_line(rio_ptr r, size_t len) {
+    char *line = r->bufptr;
+    line[len] = '\0';
+    r->bufptr += len + 1;
+    r->cnt = len < r->cnt ? r->cnt - len - 1 : 0;
+    r->eol = NULL;
+    return line;
+}
+
+static void report_truncated() {
+    report(1, "Input line longer than %d characters truncated", MAXLINE);
+}
+
 /* Read command from input file.
+   The line is returned without its newline, cut to MAXLINE characters.
    When hit EOF, close that file and return NULL
 */
 static char *readline() {
-    int cnt;
-    char c;
-    char *lptr = linebuf;
+    char *line = NULL;
+    rio_ptr r = buf_stack;
 
-    if (buf_stack == NULL)
+    if (r == NULL)
 	return NULL;
 
-    for (cnt = 0; cnt < RIO_BUFSIZE-2; cnt++) {
-	if (buf_stack->cnt <= 0) {
-	    /* Need to read from input file */
-	    buf_stack->cnt = read(buf_stack->fd, buf_stack->buf, RIO_BUFSIZE);
-	    buf_stack->bufptr = buf_stack->buf;
-	    if (buf_stack->cnt <= 0) {
-		/* Encountered EOF */
+    while (!find_eol(r) || r->skip) {
+	if (r->eol) {
+	    /* End of an overlong line, already returned in part */
+	    take_line(r, r->eol - r->bufptr);
+	    r->skip = false;
+	    continue;
+	}
+	if (r->map) {
+	    /* Mapped file ends without a newline: copy out the rest */
+	    if (r->cnt == 0) {
 		pop_file();
-		if (cnt > 0) {
-		    /* Last line of file did not terminate with newline. */
-		    /*  Terminate line & return it */
-		    *lptr++ = '\n';
-		    *lptr++ = '\0';
-		    if (echo) {
-			report_noreturn(1, prompt);
-			report_noreturn(1, linebuf);
-		    }
-		    return linebuf;
-		} else
-		    return NULL;
+		return NULL;
+	    }
+	    size_t len = r->cnt;
+	    if (len > MAXLINE) {
+		report_truncated();
+		len = MAXLINE;
 	    }
+	    memcpy(linebuf, r->bufptr, len);
+	    linebuf[len] = '\0';
+	    pop_file();
+	    line = linebuf;
+	    break;
+	}
+	if (r->skip) {
+	    /* Drop what has been read of an overlong line */
+	    r->cnt = 0;
+	    r->bufptr = r->buf;
+	} else if (r->cnt == RIO_BUFSIZE) {
+	    /* Hit buffer limit.  Keep the start, drop the rest */
+	    report_truncated();
+	    line = take_line(r, MAXLINE);
+	    r->skip = true;
+	    break;
+	}
+	/* Move partial line to front of buffer, then read more after it */
+	if (r->bufptr != r->buf) {
+	    memmove(r->buf, r->bufptr, r->cnt);
+	    r->bufptr = r->buf;
 	}
-	/* Have text in buffer */
-	c = *buf_stack->bufptr++;
-	*lptr++ = c;
-	buf_stack->cnt--;
-	if (c == '\n')
+	ssize_t n = read(r->fd, r->buf + r->cnt, RIO_BUFSIZE - r->cnt);
+	if (n <= 0) {
+	    /* Encountered EOF */
+	    if (r->cnt == 0 || r->skip) {
+		pop_file();
+		return NULL;
+	    }
+	    /* Last line of file did not terminate with newline. */
+	    memcpy(linebuf, r->buf, r->cnt);
+	    linebuf[r->cnt] = '\0';
+	    pop_file();
+	    line = linebuf;
 	    break;
+	}
+	r->cnt += n;
     }
-    if (c != '\n') {
-	/* Hit buffer limit.  Artificially terminate line */
-	*lptr++ = '\n';
+    if (!line) {
+	size_t len = r->eol - r->bufptr;
+	line = take_line(r, len);
+	if (len > MAXLINE) {
+	    /* Only mapped files hold lines this long */
+	    report_truncated();
+	    line[MAXLINE] = '\0';
+	}
     }
-    *lptr++ = '\0';
     if (echo) {
 	report_noreturn(1, prompt);
-	report_noreturn(1, linebuf);
+	report(1, "%s", line);
     }
-    return linebuf;
+    return line;
 }
 
 
@@ -501,22 +751,15 @@ void block_console() {
 
 void unblock_console() {
     block_flag = false;
-    if (block_timing) {
-	double delta = delta_time(&last_time);
-	report(1, "Delta time = %.3f", delta);
-    }
+    if (block_timing)
+	report_usage(&last_usage, "Delta");
     block_timing = false;
 }
 
 
 /* Determine if there is a complete command line in input buffer */
 static bool read_ready() {
-    int i;
-    for (i = 0; buf_stack && i < buf_stack->cnt; i++) {
-	if (buf_stack->bufptr[i] == '\n')
-	    return true;
-    }
-    return false;
+    return buf_stack && find_eol(buf_stack);
 }
 
 /*
@@ -551,7 +794,8 @@ int cmd_select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
 	if (infd == STDIN_FILENO && prompt_flag) {
 	    printf("%s", prompt);
 	    fflush(stdout);
-	    prompt_flag = true;
+	    /* Not again if select is interrupted by a signal */
+	    prompt_flag = false;
 	}
 	if (infd >= nfds) {
 	    nfds = infd+1;
@@ -570,6 +814,7 @@ int cmd_select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
 	cmdline = readline();
 	if (cmdline)
 	    interpret_cmd(cmdline);
+	prompt_flag = true;
     }
     return result;
 }
@@ -597,6 +842,8 @@ bool finish_cmd() {
 }
 
 bool run_console(char *infile_name) {
+    if (infile_name && is_compiled(infile_name))
+	return run_compiled(infile_name) && err_cnt == 0;
     if (!push_file(infile_name)) {
 	report(1, "ERROR: Could not open source file '%s'", infile_name);
 	return false;
@@ -606,3 +853,696 @@ bool run_console(char *infile_name) {
     }
     return err_cnt == 0;
 }
+
+
+/*
+  Service mode.  One epoll loop multiplexes any number of command
+  sources: standard input, clients connecting to a UNIX socket, and a
+  timerfd that prints periodic statistics.  Each client has its own line
+  buffer and error count, and sees the output of its own commands.
+  Files a client sources get their own input stack, run a line per
+  loop turn in rotation with the other clients; the client's next line
+  is taken once they are done.  Blocking the console is not supported
+  in this mode.
+*/
+struct CLIENT {
+    int fd;
+    FILE *out;             /* Where output of its commands goes */
+    int err_cnt;
+    bool closing;
+    bool eof;              /* Has sent all its input */
+    rio_ptr files;         /* Files it has sourced, still being run */
+    size_t cnt;            /* Bytes in buffer */
+    char buf[RIO_BUFSIZE + 1];
+    /*
+      Socket clients are nonblocking.  Their output collects here and is
+      written as the socket accepts it, so a client that stops reading
+      holds up only itself
+    */
+    char *obuf;
+    size_t olen, ocap;
+    uint32_t events;       /* Registered with epoll */
+    client_t *next;
+};
+
+/* Output a client may leave unread before it is dropped */
+#define CLIENT_MAXOUT (1 << 20)
+
+/* Tags for the descriptors that are not clients */
+static int listen_tag, timer_tag;
+
+static int epoll_fd = -1;
+static client_t *client_list = NULL;
+static int service_clients = 0;
+static size_t service_cmds = 0;
+static size_t service_errors = 0;
+
+static void close_active_client() {
+    active_client->closing = true;
+}
+
+/*
+  Wait for input unless it is all in or the buffer is full (which only
+  lasts while sourced files run), and for output room if any is pending
+*/
+static void update_events(client_t *c) {
+    if (c->closing)
+	return;
+    uint32_t want = (c->eof || c->cnt == RIO_BUFSIZE ? 0 : EPOLLIN)
+	| (c->olen > 0 ? EPOLLOUT : 0);
+    if (want != c->events) {
+	struct epoll_event ev;
+	ev.events = want;
+	ev.data.ptr = c;
+	epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+	c->events = want;
+    }
+}
+
+/* Write what the socket will take of client's pending output */
+static void flush_client(client_t *c) {
+    size_t done = 0;
+    while (done < c->olen) {
+	ssize_t n = write(c->fd, c->obuf + done, c->olen - done);
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n < 0 && errno != EAGAIN) {
+	    /* Gone.  Drop its output */
+	    c->closing = true;
+	    done = c->olen;
+	    break;
+	}
+	if (n < 0)
+	    break;
+	done += n;
+    }
+    c->olen -= done;
+    memmove(c->obuf, c->obuf + done, c->olen);
+    update_events(c);
+}
+
+/* Stream write function for socket clients: queue output */
+static ssize_t client_write(void *cookie, const char *buf, size_t size) {
+    client_t *c = cookie;
+    if (c->closing)
+	return size;
+    if (c->olen + size > CLIENT_MAXOUT) {
+	/* Not reading.  Can't report here, since output may go to c */
+	c->closing = true;
+	return size;
+    }
+    if (c->olen + size > c->ocap) {
+	size_t ncap = c->ocap ? c->ocap : 4096;
+	while (ncap < c->olen + size)
+	    ncap *= 2;
+	c->obuf = realloc_or_fail(c->obuf, c->ocap, ncap, "client_write");
+	c->ocap = ncap;
+    }
+    memcpy(c->obuf + c->olen, buf, size);
+    c->olen += size;
+    return size;
+}
+
+/* out is NULL for a socket, whose output is queued */
+static client_t *new_client(int fd, FILE *out) {
+    client_t *c = malloc_or_fail(sizeof(client_t), "new_client");
+    c->fd = fd;
+    c->out = out;
+    c->err_cnt = 0;
+    c->closing = false;
+    c->eof = false;
+    c->files = NULL;
+    c->cnt = 0;
+    c->obuf = NULL;
+    c->olen = c->ocap = 0;
+    c->events = EPOLLIN;
+    if (!out) {
+	cookie_io_functions_t io = { .write = client_write };
+	c->out = fopencookie(c, "w", io);
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = c;
+    if (!c->out || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+	if (c->out && c->out != stdout)
+	    fclose(c->out);
+	free_block(c, sizeof(client_t));
+	return NULL;
+    }
+    c->next = client_list;
+    client_list = c;
+    service_clients++;
+    return c;
+}
+
+static void free_client(client_t *c) {
+    if (c == stdin_client)
+	stdin_client = NULL;
+    client_t **loc = &client_list;
+    while (*loc != c)
+	loc = &(*loc)->next;
+    *loc = c->next;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    /* Files it left unfinished, with nobody to report their times to */
+    rio_ptr saved = buf_stack;
+    buf_stack = c->files;
+    while (buf_stack) {
+	buf_stack->timed = false;
+	pop_file();
+    }
+    buf_stack = saved;
+    if (c->out != stdout) {
+	/* Last output goes if the socket takes it now */
+	fclose(c->out);
+	c->closing = true;
+	flush_client(c);
+	close(c->fd);
+	if (c->obuf)
+	    free_block(c->obuf, c->ocap);
+    }
+    service_clients--;
+    free_block(c, sizeof(client_t));
+}
+
+/* Charge output and errors to client until client_leave */
+static int saved_err_cnt;
+
+static void client_enter(client_t *c) {
+    saved_err_cnt = err_cnt;
+    err_cnt = c->err_cnt;
+    active_client = c;
+    init_files(c->out, c->out);
+}
+
+static void client_leave(client_t *c) {
+    service_errors += err_cnt - c->err_cnt;
+    c->err_cnt = err_cnt;
+    err_cnt = saved_err_cnt;
+    active_client = NULL;
+    init_files(stdout, stdout);
+}
+
+/*
+  Run one line from client.  Files it sources move to the client's own
+  stack (buf_stack is empty between service commands), to be run by
+  serve_file_line
+*/
+static void serve_line(client_t *c, char *line) {
+    client_enter(c);
+    if (echo) {
+	report_noreturn(1, prompt);
+	report(1, "%s", line);
+    }
+    interpret_cmd(line);
+    c->files = buf_stack;
+    buf_stack = NULL;
+    service_cmds++;
+    client_leave(c);
+}
+
+/* Run the next line of the files client has sourced */
+static void serve_file_line(client_t *c) {
+    client_enter(c);
+    buf_stack = c->files;
+    char *line = readline();
+    if (line)
+	interpret_cmd(line);
+    c->files = buf_stack;
+    buf_stack = NULL;
+    client_leave(c);
+}
+
+/*
+  Take a turn for client: one line of its sourced files if it has any,
+  else every complete line it has sent, up to one that sources a file
+*/
+static void run_client(client_t *c) {
+    if (c->files && !c->closing && !quit_flag)
+	serve_file_line(c);
+    char *start = c->buf;
+    char *eol;
+    while (!c->files && !c->closing && !quit_flag
+	   && (eol = memchr(start, '\n', c->buf + c->cnt - start))) {
+	*eol = '\0';
+	serve_line(c, start);
+	start = eol + 1;
+    }
+    c->cnt -= start - c->buf;
+    if (c->cnt > 0 && start != c->buf)
+	memmove(c->buf, start, c->cnt);
+    if (!c->files && !c->closing && !quit_flag
+	&& (c->cnt == RIO_BUFSIZE || (c->eof && c->cnt > 0))) {
+	/* Hit buffer limit, or a last line with no newline */
+	c->buf[c->cnt] = '\0';
+	c->cnt = 0;
+	serve_line(c, c->buf);
+    }
+    if (!c->files && !c->eof && !c->closing && !quit_flag
+	&& c != stdin_client)
+	fputs(prompt, c->out);
+    fflush(c->out);
+    flush_client(c);
+    if (c->closing || (c->eof && !c->files && c->cnt == 0))
+	free_client(c);
+    else
+	update_events(c);
+}
+
+/* Read what client has sent, then give it a turn */
+static void serve_client(client_t *c) {
+    /* A hangup is reported even while input is not wanted */
+    if (!c->eof && c->cnt < RIO_BUFSIZE) {
+	ssize_t n = read(c->fd, c->buf + c->cnt, RIO_BUFSIZE - c->cnt);
+	if (n < 0 && (errno == EAGAIN || errno == EINTR))
+	    return;
+	if (n <= 0)
+	    c->eof = true;
+	else
+	    c->cnt += n;
+    }
+    /* Lines wait while its files run, one line per turn */
+    if (c->files && !c->closing)
+	update_events(c);
+    else
+	run_client(c);
+}
+
+/* Give a turn to each client that is running sourced files */
+static bool run_files() {
+    bool more = false;
+    client_t *c = client_list;
+    while (c && !quit_flag) {
+	client_t *next = c->next;
+	if (c->files) {
+	    run_client(c);
+	    more = true;
+	}
+	c = next;
+    }
+    return more;
+}
+
+static void accept_clients(int listen_fd) {
+    int fd;
+    while ((fd = accept4(listen_fd, NULL, NULL,
+			 SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+	client_t *c = new_client(fd, NULL);
+	if (!c) {
+	    report(1, "Could not accept client");
+	    close(fd);
+	    continue;
+	}
+	fputs(prompt, c->out);
+	fflush(c->out);
+	flush_client(c);
+	if (c->closing)
+	    free_client(c);
+    }
+}
+
+static void report_stats(int timer_fd, double start) {
+    uint64_t ticks;
+    if (read(timer_fd, &ticks, sizeof(ticks)) != sizeof(ticks))
+	return;
+    double now = 0;
+    init_time(&now);
+    double secs = now - start;
+    report(1, "Service: %d clients, %lu commands (%.1f/sec), %lu errors, "
+	   "%lu bytes allocated",
+	   service_clients, (unsigned long) service_cmds,
+	   secs > 0 ? service_cmds / secs : 0.0,
+	   (unsigned long) service_errors, (unsigned long) current_bytes);
+}
+
+/* Open listening UNIX socket.  Return its descriptor, or -1 */
+static int open_listener(char *path) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+	report(1, "Socket path '%s' too long", path);
+	return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+	return -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0
+	|| listen(fd, SOMAXCONN) < 0) {
+	close(fd);
+	return -1;
+    }
+    return fd;
+}
+
+bool run_service(char *infile_name, char *socket_name, int stats_ms) {
+    struct epoll_event ev;
+    bool ok = true;
+    int listen_fd = -1;
+    int timer_fd = -1;
+    double start = 0;
+
+    /* A disconnected client should not kill the service */
+    signal(SIGPIPE, SIG_IGN);
+    init_time(&start);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+	report(1, "ERROR: Could not create epoll instance");
+	return false;
+    }
+    if (infile_name) {
+	/* Initial script runs to completion first */
+	if (!push_file(infile_name)) {
+	    report(1, "ERROR: Could not open source file '%s'", infile_name);
+	    ok = false;
+	}
+	drain_files(NULL);
+    } else if (!(stdin_client = new_client(STDIN_FILENO, stdout))) {
+	/* Regular files cannot be polled.  Run it as an initial script */
+	push_file(NULL);
+	drain_files(NULL);
+    }
+    if (ok && socket_name) {
+	listen_fd = open_listener(socket_name);
+	ev.events = EPOLLIN;
+	ev.data.ptr = &listen_tag;
+	if (listen_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) < 0) {
+	    report(1, "ERROR: Could not listen on '%s'", socket_name);
+	    ok = false;
+	}
+    }
+    if (ok && stats_ms > 0) {
+	struct itimerspec period;
+	period.it_interval.tv_sec = stats_ms / 1000;
+	period.it_interval.tv_nsec = (stats_ms % 1000) * 1000000L;
+	period.it_value = period.it_interval;
+	timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	ev.events = EPOLLIN;
+	ev.data.ptr = &timer_tag;
+	if (timer_fd < 0 || timerfd_settime(timer_fd, 0, &period, NULL) < 0
+	    || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev) < 0) {
+	    report(1, "ERROR: Could not start statistics timer");
+	    ok = false;
+	}
+    }
+
+#define MAX_EVENTS 64
+    struct epoll_event events[MAX_EVENTS];
+    /* Without a socket, the service ends when its last source does */
+    bool files = false;
+    while (ok && !quit_flag && (listen_fd >= 0 || service_clients > 0)) {
+	/* Sourced files are still running: only poll */
+	int n = epoll_wait(epoll_fd, events, MAX_EVENTS, files ? 0 : -1);
+	if (n < 0 && errno != EINTR) {
+	    report(1, "ERROR: epoll_wait failed");
+	    ok = false;
+	}
+	int i;
+	for (i = 0; i < n && !quit_flag; i++) {
+	    void *tag = events[i].data.ptr;
+	    if (tag == &listen_tag)
+		accept_clients(listen_fd);
+	    else if (tag == &timer_tag)
+		report_stats(timer_fd, start);
+	    else {
+		client_t *c = (client_t *) tag;
+		if (events[i].events & EPOLLOUT) {
+		    flush_client(c);
+		    if (c->closing) {
+			free_client(c);
+			continue;
+		    }
+		}
+		if (events[i].events & ~EPOLLOUT)
+		    serve_client(c);
+	    }
+	}
+	files = run_files();
+    }
+    while (client_list)
+	free_client(client_list);
+    if (listen_fd >= 0) {
+	close(listen_fd);
+	unlink(socket_name);
+    }
+    if (timer_fd >= 0)
+	close(timer_fd);
+    close(epoll_fd);
+    epoll_fd = -1;
+    return ok && err_cnt == 0;
+}
+
+/*
+  Compiled traces.  The file holds 32-bit words in host byte order:
+
+    magic, version, number of names, words of names,
+    command names, each null-terminated, padded to a word,
+    records.
+
+  Each record starts with a word holding an opcode in its low 8 bits and
+  a count in the rest.  Opcode k > 0 names the k'th command, and is
+  followed by count integer arguments.  Opcode 0 is a text line of count
+  bytes (including the null), padded to a word, for commands that must
+  still be parsed.
+*/
+#define BC_MAGIC 0x43425451   /* "QTBC" */
+#define BC_VERSION 1
+#define BC_MAXOPS 255
+#define BC_HEADER 4
+
+/* Words needed to hold n bytes */
+#define BC_WORDS(n) (((n) + 3) / 4)
+
+/* Does file start with the compiled trace magic number? */
+static bool is_compiled(char *fname) {
+    uint32_t magic = 0;
+    int fd = open(fname, O_RDONLY);
+    if (fd < 0)
+	return false;
+    bool found = read(fd, &magic, sizeof(magic)) == sizeof(magic)
+	&& magic == BC_MAGIC;
+    close(fd);
+    return found;
+}
+
+/* Echo compiled command the way readline would echo its source line */
+static void echo_compiled(cmd_ptr c, int argc, int argv[]) {
+    int i;
+    report_noreturn(1, "%s%s", prompt, c->name);
+    for (i = 0; i < argc; i++)
+	report_noreturn(1, " %d", argv[i]);
+    report(1, "");
+}
+
+/* Run nested text files pushed by a source command in a compiled trace */
+static void drain_files(rio_ptr base) {
+    while (buf_stack != base && !quit_flag) {
+	char *line = readline();
+	if (line)
+	    interpret_cmd(line);
+    }
+}
+
+/*
+  Replay compiled trace.  Each record dispatches straight to the command,
+  bypassing the line reader, parse_args and the command table
+*/
+static bool run_compiled(char *fname) {
+    int fd = open(fname, O_RDONLY);
+    if (fd < 0) {
+	report(1, "Could not open compiled trace '%s'", fname);
+	return false;
+    }
+    struct stat st;
+    uint32_t *map = MAP_FAILED;
+    size_t len = 0;
+    if (fstat(fd, &st) == 0 && st.st_size >= BC_HEADER * sizeof(uint32_t)) {
+	len = st.st_size;
+	/* Private and writable, so text records can be split in place */
+	map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+	report(1, "Could not map compiled trace '%s'", fname);
+	return false;
+    }
+    madvise(map, len, MADV_SEQUENTIAL);
+    uint32_t *end = map + len / sizeof(uint32_t);
+    uint32_t nops = map[2];
+    uint32_t *p = map + BC_HEADER;
+    bool ok = map[1] == BC_VERSION && nops <= BC_MAXOPS
+	&& map[3] <= end - p;
+    if (!ok)
+	report(1, "Compiled trace '%s' has bad header", fname);
+
+    /* Resolve opcodes to commands */
+    cmd_ptr ops[BC_MAXOPS + 1];
+    char *name = (char *) p;
+    char *name_end = ok ? (char *) (p + map[3]) : name;
+    uint32_t i;
+    for (i = 1; ok && i <= nops; i++) {
+	char *nul = memchr(name, '\0', name_end - name);
+	ops[i] = nul ? find_cmd(name) : NULL;
+	if (!ops[i]) {
+	    report(1, "Compiled trace uses unknown command '%s'",
+		   nul ? name : "?");
+	    ok = false;
+	} else
+	    name = nul + 1;
+    }
+    if (ok)
+	p += map[3];
+
+    rio_ptr base = buf_stack;
+    while (ok && p < end && !quit_flag) {
+	uint32_t op = *p & 0xff;
+	uint32_t cnt = *p++ >> 8;
+	uint32_t words = op ? cnt : BC_WORDS(cnt);
+	if (op > nops || words > end - p || (op == 0 && cnt == 0)) {
+	    report(1, "Compiled trace '%s' is corrupted", fname);
+	    ok = false;
+	    break;
+	}
+	if (op == 0) {
+	    char *line = (char *) p;
+	    line[cnt - 1] = '\0';
+	    if (echo) {
+		report_noreturn(1, prompt);
+		report(1, "%s", line);
+	    }
+	    interpret_cmd(line);
+	    drain_files(base);
+	} else {
+	    cmd_ptr c = ops[op];
+	    int *argv = (int *) p;
+	    bool cok;
+	    if (echo)
+		echo_compiled(c, cnt, argv);
+	    if (c->int_operation)
+		cok = c->int_operation(cnt, argv);
+	    else if (cnt == 0)
+		cok = c->operation(1, &c->name);
+	    else {
+		report(1, "Command '%s' takes no integer arguments", c->name);
+		cok = false;
+	    }
+	    if (!cok)
+		record_error();
+	}
+	p += words;
+    }
+    munmap(map, len);
+    return ok;
+}
+
+/* Append words to output file */
+static bool put_words(FILE *fp, void *data, size_t nbytes) {
+    static const char pad[4];
+    size_t extra = 4 * BC_WORDS(nbytes) - nbytes;
+    return fwrite(data, 1, nbytes, fp) == nbytes
+	&& fwrite(pad, 1, extra, fp) == extra;
+}
+
+/* Compile command file into binary trace */
+bool compile_cmd_file(char *infile_name, char *outfile_name) {
+    static char text[RIO_BUFSIZE + 1];
+    static int args[MAXARGS];
+    cmd_ptr ops[BC_MAXOPS + 1];
+    uint32_t nops = 0;
+    size_t name_bytes = 0;
+    bool ok = true;
+
+    if (!push_file(infile_name)) {
+	report(1, "Could not open source file '%s'",
+	       infile_name ? infile_name : "standard input");
+	return false;
+    }
+    /* Records go to a temporary file until the name table is known */
+    FILE *body = tmpfile();
+    FILE *out = fopen(outfile_name, "w");
+    if (!body || !out) {
+	report(1, "Could not create compiled trace '%s'", outfile_name);
+	ok = false;
+    }
+    rio_ptr base = buf_stack->prev;
+    while (ok && buf_stack != base) {
+	char *line = readline();
+	if (!line)
+	    continue;
+	size_t tlen = strlen(line) + 1;
+	/* readline cuts lines to MAXLINE, and the count has 24 bits */
+	if (tlen > sizeof(text) || tlen > 0xffffff) {
+	    report(1, "Line of %lu characters too long to compile", tlen - 1);
+	    ok = false;
+	    break;
+	}
+	memcpy(text, line, tlen);
+	int argc = parse_args(line, arg_buf, MAXARGS);
+	if (argc < 0) {
+	    report(1, "Line with more than %d words cannot be compiled",
+		   MAXARGS);
+	    ok = false;
+	    break;
+	}
+	/* Blank lines stay, since they are echoed */
+	cmd_ptr c = argc > 0 ? find_cmd(arg_buf[0]) : NULL;
+	int i;
+	bool ints = c && (c->int_operation || argc == 1) && argc - 1 <= 0xffffff;
+	for (i = 1; ints && i < argc; i++)
+	    ints = get_int(arg_buf[i], &args[i - 1]);
+	uint32_t op = 0;
+	for (i = 1; ints && i <= nops && ops[i] != c; i++)
+	    ;
+	if (ints && i <= BC_MAXOPS) {
+	    if (i > nops) {
+		ops[++nops] = c;
+		name_bytes += strlen(c->name) + 1;
+	    }
+	    op = i;
+	}
+	uint32_t word;
+	if (op) {
+	    word = op | (uint32_t) (argc - 1) << 8;
+	    ok = put_words(body, &word, sizeof(word))
+		&& put_words(body, args, (argc - 1) * sizeof(int));
+	} else {
+	    word = (uint32_t) tlen << 8;
+	    ok = put_words(body, &word, sizeof(word))
+		&& put_words(body, text, tlen);
+	}
+    }
+    while (buf_stack != base)
+	pop_file();
+
+    if (ok) {
+	uint32_t header[BC_HEADER] =
+	    { BC_MAGIC, BC_VERSION, nops, BC_WORDS(name_bytes) };
+	char names[BC_MAXOPS * 32];
+	char *np = names;
+	uint32_t i;
+	ok = name_bytes <= sizeof(names);
+	for (i = 1; ok && i <= nops; i++) {
+	    strcpy(np, ops[i]->name);
+	    np += strlen(ops[i]->name) + 1;
+	}
+	ok = ok && put_words(out, header, sizeof(header))
+	    && put_words(out, names, name_bytes);
+	/* Copy records after the header */
+	char copy[RIO_BUFSIZE];
+	size_t n;
+	rewind(body);
+	while (ok && (n = fread(copy, 1, sizeof(copy), body)) > 0)
+	    ok = fwrite(copy, 1, n, out) == n;
+	if (!ok)
+	    report(1, "Could not write compiled trace '%s'", outfile_name);
+    }
+    if (body)
+	fclose(body);
+    if (out && fclose(out) != 0)
+	ok = false;
+    /* Don't leave a partial trace to be replayed */
+    if (!ok && out)
+	remove(outfile_name);
+    return ok;
+}
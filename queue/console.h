@@ -3,14 +3,19 @@
 /* Each command defined in terms of a function */
 typedef bool (*cmd_function)(int argc, char *argv[]);
 
+/* Optional entry point taking integer arguments (command name not included) */
+typedef bool (*int_cmd_function)(int argc, int argv[]);
+
 /* Information about each command */
-/* Organized as linked list in alphabetical order */
+/* Organized as linked list in alphabetical order, and hashed by name */
 typedef struct CELE cmd_ele, *cmd_ptr;
 struct CELE {
     char *name;
     cmd_function operation;
+    int_cmd_function int_operation;  /* Used when replaying compiled traces */
     char *documentation;
     cmd_ptr next;
+    cmd_ptr hash_next;  /* Next command in same hash bucket */
 };
 
 /* Optionally supply function that gets invoked when parameter changes */
@@ -33,11 +38,17 @@ void init_cmd();
 /* Add a new command */
 void add_cmd(char *name, cmd_function operation, char *documentation);
 
+/*
+  Give existing command an integer entry point.  Compiled traces call it
+  directly with the arguments already converted
+*/
+void add_int_cmd(char *name, int_cmd_function operation);
+
 /* Add a new parameter */
 void add_param(char *name, int *valp, char *doccumentation,
 	       setter_function setter);
 
-/* Execute a command from a command line */
+/* Execute a command from a command line.  The line is split in place */
 bool interpret_cmd(char *cmdline);
 
 /* Execute a sequence of commands read from a file */
@@ -94,6 +105,23 @@ bool finish_cmd();
 int cmd_select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
 	       struct timeval *timeout);
 
-/* Run command loop.  Non-null infile_name implies read commands from that file */
+/* Run command loop.  Non-null infile_name implies read commands from that file.
+   The file may be a compiled trace */
 bool run_console(char *infile_name);
 
+/*
+  Run as a long-lived service.  Commands come from infile_name (run first,
+  to completion) or else stdin, and from clients connecting to the UNIX
+  socket socket_name (if not NULL), each of which gets its own output.
+  If stats_ms > 0, statistics are printed every stats_ms milliseconds.
+  Runs until a quit command, or without a socket, until input ends
+*/
+bool run_service(char *infile_name, char *socket_name, int stats_ms);
+
+/*
+  Compile command file (stdin if infile_name is NULL) into binary trace.
+  Commands with integer entry points, or without arguments, become an
+  opcode plus integer arguments.  Anything else is kept as text
+*/
+bool compile_cmd_file(char *infile_name, char *outfile_name);
+
@@ -0,0 +1,210 @@
+/*
+ * Stress test and throughput benchmark for the concurrent queue.
+ *
+ * For each thread count T from 1 up to the limit, run T producers and
+ * T consumers over one shared cqueue_t.  Producer p pushes values
+ * encoding (p, sequence number); each consumer checks that values
+ * from any one producer arrive in increasing order, and at the end the
+ * number and checksum of popped values must match what was pushed.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "cqueue.h"
+
+#define SEQ_BITS 24
+#define SEQ_MASK ((1 << SEQ_BITS) - 1)
+#define MAX_THREADS 64
+
+static cqueue_t *cq;
+static int nthreads;
+static int per_producer;
+static atomic_int consumed;
+static atomic_int failed;
+/* Set when a round could not start all its threads */
+static atomic_int stop;
+
+typedef struct {
+    int id;
+    uint64_t sum;
+    long count;
+} worker_t;
+
+static void *producer(void *arg)
+{
+    worker_t *w = arg;
+    int i;
+    for (i = 0; i < per_producer; i++) {
+	int v = (w->id << SEQ_BITS) | i;
+	while (!cq_push(cq, v)) {
+	    if (atomic_load(&stop))
+		return NULL;
+	    sched_yield();
+	}
+	w->sum += (uint64_t) v;
+	w->count++;
+    }
+    return NULL;
+}
+
+static void *consumer(void *arg)
+{
+    worker_t *w = arg;
+    int last[MAX_THREADS];
+    int total = nthreads * per_producer;
+    int p;
+    for (p = 0; p < nthreads; p++)
+	last[p] = -1;
+    while (atomic_load(&consumed) < total) {
+	int v;
+	if (!cq_pop(cq, &v)) {
+	    if (atomic_load(&stop))
+		return NULL;
+	    sched_yield();
+	    continue;
+	}
+	atomic_fetch_add(&consumed, 1);
+	p = v >> SEQ_BITS;
+	if (p >= nthreads || (v & SEQ_MASK) <= last[p]) {
+	    fprintf(stderr, "Out of order value %d from producer %d\n",
+		    v & SEQ_MASK, p);
+	    atomic_store(&failed, 1);
+	} else {
+	    last[p] = v & SEQ_MASK;
+	}
+	w->sum += (uint64_t) v;
+	w->count++;
+    }
+    return NULL;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Run one round with t producers and t consumers.  Return true if OK */
+static bool run(int t, int ops, size_t capacity)
+{
+    pthread_t ptid[MAX_THREADS], ctid[MAX_THREADS];
+    worker_t pw[MAX_THREADS], cw[MAX_THREADS];
+    int i, np = 0, nc = 0;
+
+    cq = cq_new(capacity);
+    if (!cq) {
+	fprintf(stderr, "Could not allocate queue\n");
+	return false;
+    }
+    nthreads = t;
+    per_producer = ops / t;
+    atomic_store(&consumed, 0);
+    atomic_store(&failed, 0);
+    atomic_store(&stop, 0);
+    for (i = 0; i < t; i++) {
+	pw[i] = (worker_t) {.id = i};
+	cw[i] = (worker_t) {.id = i};
+    }
+    double start = now();
+    for (i = 0; i < t; i++) {
+	if (pthread_create(&ctid[nc], NULL, consumer, &cw[i]) != 0)
+	    break;
+	nc++;
+	if (pthread_create(&ptid[np], NULL, producer, &pw[i]) != 0)
+	    break;
+	np++;
+    }
+    bool started = np == t;
+    if (!started) {
+	/* The values the round expects will never all arrive */
+	fprintf(stderr, "Could only start %d producers and %d consumers of %d\n",
+		np, nc, t);
+	atomic_store(&stop, 1);
+    }
+    for (i = 0; i < np; i++)
+	pthread_join(ptid[i], NULL);
+    for (i = 0; i < nc; i++)
+	pthread_join(ctid[i], NULL);
+    double secs = now() - start;
+
+    uint64_t psum = 0, csum = 0;
+    long pcount = 0, ccount = 0;
+    for (i = 0; i < t; i++) {
+	psum += pw[i].sum;
+	pcount += pw[i].count;
+	csum += cw[i].sum;
+	ccount += cw[i].count;
+    }
+    int v;
+    bool ok = started && !atomic_load(&failed) && psum == csum && pcount == ccount
+	&& !cq_pop(cq, &v);
+    cq_free(cq);
+    printf("%7d %12ld %10.3f %14.0f  %s\n", t, pcount, secs,
+	   secs > 0 ? (pcount + ccount) / secs : 0.0, ok ? "ok" : "FAILED");
+    if (pcount != ccount || psum != csum)
+	fprintf(stderr, "Pushed %ld (sum %llu), popped %ld (sum %llu)\n",
+		pcount, (unsigned long long) psum,
+		ccount, (unsigned long long) csum);
+    return ok;
+}
+
+static void usage(char *cmd)
+{
+    printf("Usage: %s [-h] [-t THREADS] [-n OPS] [-c CAPACITY]\n", cmd);
+    printf("\t-h         Print this information\n");
+    printf("\t-t THREADS Largest number of producer/consumer pairs\n");
+    printf("\t-n OPS     Values pushed per round, split among producers (at most %d)\n",
+	   SEQ_MASK);
+    printf("\t-c CAP     Queue capacity\n");
+    exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+    int max_threads = 4;
+    int ops = 1000000;
+    size_t capacity = 1024;
+    int c;
+
+    while ((c = getopt(argc, argv, "ht:n:c:")) != -1) {
+	switch (c) {
+	case 't':
+	    max_threads = atoi(optarg);
+	    break;
+	case 'n':
+	    ops = atoi(optarg);
+	    break;
+	case 'c':
+	    capacity = (size_t) atol(optarg);
+	    break;
+	default:
+	    usage(argv[0]);
+	}
+    }
+    if (max_threads < 1 || max_threads > MAX_THREADS) {
+	fprintf(stderr, "Thread count must be between 1 and %d\n",
+		MAX_THREADS);
+	return 1;
+    }
+    /* The one-thread round sends every value through one producer */
+    if (ops < max_threads || ops > SEQ_MASK) {
+	fprintf(stderr, "Op count out of range\n");
+	return 1;
+    }
+
+    bool ok = true;
+    printf("%7s %12s %10s %14s\n", "threads", "values", "secs", "ops/sec");
+    int t;
+    for (t = 1; t <= max_threads; t *= 2)
+	ok = run(t, ops, capacity) && ok;
+    return ok ? 0 : 1;
+}
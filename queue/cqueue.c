@@ -0,0 +1,115 @@
+/*
+ * Lock-free bounded MPMC queue (see cqueue.h).
+ *
+ * Uses the system malloc directly: the test harness allocator is not
+ * thread safe.
+ */
+
+#include <stdlib.h>
+
+#include "cqueue.h"
+
+/* aligned_alloc requires a size that is a multiple of the alignment */
+static size_t line_round(size_t size)
+{
+    return (size + CQ_LINE - 1) & ~(size_t) (CQ_LINE - 1);
+}
+
+/*
+  Create empty queue holding up to capacity values,
+  rounded up to a power of two.
+  Return NULL if could not allocate space.
+*/
+cqueue_t *cq_new(size_t capacity)
+{
+    size_t cap = 2;
+    while (cap < capacity)
+	cap *= 2;
+    cqueue_t *q = aligned_alloc(CQ_LINE, line_round(sizeof(cqueue_t)));
+    if (!q)
+	return NULL;
+    q->cells = aligned_alloc(CQ_LINE, line_round(cap * sizeof(cq_cell_t)));
+    if (!q->cells) {
+	free(q);
+	return NULL;
+    }
+    size_t i;
+    for (i = 0; i < cap; i++)
+	atomic_init(&q->cells[i].seq, i);
+    q->mask = cap - 1;
+    atomic_init(&q->enqueue_pos, 0);
+    atomic_init(&q->dequeue_pos, 0);
+    return q;
+}
+
+/* Free all storage used by queue */
+void cq_free(cqueue_t *q)
+{
+    if (!q)
+	return;
+    free(q->cells);
+    free(q);
+}
+
+/*
+  A producer owns position pos once its CAS succeeds.  The cell for pos
+  is free when its seq equals pos; it was filled one lap ago (and not
+  yet drained) when seq is smaller, meaning the queue is full.
+*/
+bool cq_push(cqueue_t *q, int v)
+{
+    size_t pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+    cq_cell_t *cell;
+    for (;;) {
+	cell = &q->cells[pos & q->mask];
+	size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+	ptrdiff_t diff = (ptrdiff_t) seq - (ptrdiff_t) pos;
+	if (diff == 0) {
+	    if (atomic_compare_exchange_weak_explicit(&q->enqueue_pos, &pos,
+						      pos + 1,
+						      memory_order_relaxed,
+						      memory_order_relaxed))
+		break;
+	    /* Lost the race; pos now holds the current position */
+	} else if (diff < 0) {
+	    return false;
+	} else {
+	    pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+	}
+    }
+    cell->value = v;
+    /* Publish: consumers wait for seq == pos + 1 */
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+    return true;
+}
+
+/*
+  A consumer owns position pos once its CAS succeeds.  The cell holds a
+  value for pos when its seq equals pos + 1; a smaller seq means the
+  producer has not finished with it, so the queue is empty.
+*/
+bool cq_pop(cqueue_t *q, int *vp)
+{
+    size_t pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+    cq_cell_t *cell;
+    for (;;) {
+	cell = &q->cells[pos & q->mask];
+	size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+	ptrdiff_t diff = (ptrdiff_t) seq - (ptrdiff_t) (pos + 1);
+	if (diff == 0) {
+	    if (atomic_compare_exchange_weak_explicit(&q->dequeue_pos, &pos,
+						      pos + 1,
+						      memory_order_relaxed,
+						      memory_order_relaxed))
+		break;
+	} else if (diff < 0) {
+	    return false;
+	} else {
+	    pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+	}
+    }
+    *vp = cell->value;
+    /* Hand the cell to the producer one lap ahead */
+    atomic_store_explicit(&cell->seq, pos + q->mask + 1, memory_order_release);
+    return true;
+}
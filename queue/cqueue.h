@@ -0,0 +1,59 @@
+/*
+ * Concurrent queue of ints shared between threads.
+ *
+ * Bounded multi-producer / multi-consumer queue after Dmitry Vyukov's
+ * lock-free ring: every cell carries a sequence number that tells
+ * producers and consumers whether it is ready for them, and threads
+ * claim cells with a compare-and-swap on the enqueue or dequeue
+ * position.  Cells are never freed while the queue is in use, so no
+ * hazard pointers or epochs are needed to reclaim memory.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+/* Assumed size of a cache line */
+#define CQ_LINE 64
+
+typedef struct {
+    atomic_size_t seq;  /* Position this cell is ready for */
+    int value;
+} cq_cell_t;
+
+typedef struct {
+    cq_cell_t *cells;
+    size_t mask;        /* Capacity - 1 */
+    char pad0[CQ_LINE];
+    atomic_size_t enqueue_pos;
+    char pad1[CQ_LINE - sizeof(atomic_size_t)];
+    atomic_size_t dequeue_pos;
+    char pad2[CQ_LINE - sizeof(atomic_size_t)];
+} cqueue_t;
+
+/*
+  Create empty queue holding up to capacity values,
+  rounded up to a power of two.
+  Return NULL if could not allocate space.
+*/
+cqueue_t *cq_new(size_t capacity);
+
+/*
+  Free all storage used by queue.
+  No other thread may be using it.  No effect if q is NULL
+*/
+void cq_free(cqueue_t *q);
+
+/*
+  Attempt to insert v at tail of queue.
+  Return false if queue is full.
+  Safe to call from any number of threads.
+*/
+bool cq_push(cqueue_t *q, int v);
+
+/*
+  Attempt to remove value from head of queue and store it at *vp.
+  Return false if queue is empty.
+  Safe to call from any number of threads.
+*/
+bool cq_pop(cqueue_t *q, int *vp);
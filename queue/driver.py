@@ -3,6 +3,8 @@
 import subprocess
 import sys
 import getopt
+import os
+import tempfile
 
 # Driver program for C programming exercise
 class Tracer:
@@ -11,6 +13,8 @@ class Tracer:
     qtest = "./qtest"
     verbLevel = 0
     autograde = False
+    backend = None
+    compiled = False
 
     traceDict = {
         1 : "trace-01-ops",
@@ -26,7 +30,19 @@ class Tracer:
         11 : "trace-11-malloc",
         12 : "trace-12-perf",
         13 : "trace-13-perf",
-        14 : "trace-14-perf"
+        14 : "trace-14-perf",
+        15 : "trace-15-perf",
+        16 : "trace-16-ops",
+        17 : "trace-17-perf",
+        18 : "trace-18-ops",
+        19 : "trace-19-perf",
+        20 : "trace-20-ops",
+        21 : "trace-21-perf",
+        22 : "trace-22-ops",
+        23 : "trace-23-perf",
+        24 : "trace-24-ops",
+        25 : "trace-25-malloc",
+        26 : "trace-26-perf"
         }
 
     traceProbs = {
@@ -43,30 +59,68 @@ class Tracer:
         11 : "Trace-11",
         12 : "Trace-12",
         13 : "Trace-13",
-        14 : "Trace-14"
+        14 : "Trace-14",
+        15 : "Trace-15",
+        16 : "Trace-16",
+        17 : "Trace-17",
+        18 : "Trace-18",
+        19 : "Trace-19",
+        20 : "Trace-20",
+        21 : "Trace-21",
+        22 : "Trace-22",
+        23 : "Trace-23",
+        24 : "Trace-24",
+        25 : "Trace-25",
+        26 : "Trace-26"
         }
 
 
-    maxScores = [0, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 8, 8]
+    maxScores = [0, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 8, 8, 8, 7, 8, 7, 8, 7, 8, 7, 8, 7, 7, 8]
 
-    def __init__(self, qtest = "", verbLevel = 0, autograde = False):
+    def __init__(self, qtest = "", verbLevel = 0, autograde = False, backend = None, compiled = False):
         if qtest != "":
             self.qtest = qtest
         self.verbLevel = verbLevel
         self.autograde = autograde
+        self.backend = backend
+        self.compiled = compiled
+
+    # Compile trace into binary form.  Return its name, or None on failure
+    def compileTrace(self, fname):
+        fd, cname = tempfile.mkstemp(suffix = ".qbc")
+        os.close(fd)
+        try:
+            retcode = subprocess.call([self.qtest, "-v", "1", "-c", cname, "-f", fname])
+        except Exception as e:
+            print ("Compilation of '%s' failed: %s" % (fname, e))
+            retcode = 1
+        if retcode != 0:
+            os.remove(cname)
+            return None
+        return cname
 
     def runTrace(self, tid):
         if not tid in self.traceDict:
             print ("ERROR: No trace with id %d" % tid)
             return False
         fname = "%s/%s.cmd" % (self.traceDirectory, self.traceDict[tid])
+        cname = None
+        if self.compiled:
+            cname = self.compileTrace(fname)
+            if cname is None:
+                return False
+            fname = cname
         vname = "%d" % self.verbLevel
         clist = [self.qtest, "-v", vname, "-f", fname]
+        if self.backend is not None:
+            clist += ["-q", "%d" % self.backend]
         try:
             retcode = subprocess.call(clist)
         except Exception as e:
             print ("Call of '%s' failed: %s" % (" ".join(clist), e))
-            return False
+            retcode = 1
+        if cname is not None:
+            os.remove(cname)
         return retcode == 0
 
     def run(self, tid = 0):
@@ -111,11 +165,13 @@ class Tracer:
             print ("{{ \"scores\": {{ \"auto\": {} }} }}".format(score))
 
 def usage(name):
-    print ("Usage: %s [-h] [-p PROG] [-t TID] [-v VLEVEL]" % name)
+    print ("Usage: %s [-h] [-p PROG] [-t TID] [-v VLEVEL] [-q BACKEND] [-b]" % name)
     print ("  -h        Print this message")
     print ("  -p PROG   Program to test")
     print ("  -t TID    Trace ID to test")
     print ("  -v VLEVEL Set verbosity level (0-3)")
+    print ("  -q BACKEND Queue representation for qtest (0 = list, 1 = chunked, 2 = ring)")
+    print ("  -b        Compile traces and replay them in binary form")
     sys.exit(0)
 
 def run(name, args):
@@ -124,9 +180,11 @@ def run(name, args):
     vlevel = 1
     levelFixed = False
     autograde = False
+    backend = None
+    compiled = False
 
 
-    optlist, args = getopt.getopt(args, 'hp:t:v:A')
+    optlist, args = getopt.getopt(args, 'hp:t:v:Aq:b')
     for (opt, val) in optlist:
         if opt == '-h':
             usage(name)
@@ -139,12 +197,17 @@ def run(name, args):
             levelFixed = True
         elif opt == '-A':
             autograde = True
+        elif opt == '-q':
+            backend = int(val)
+        elif opt == '-b':
+            compiled = True
         else:
             print ("Unrecognized option '%s'" % opt)
             usage(name)
     if not levelFixed and autograde:
         vlevel = 0
-    t = Tracer(qtest = prog, verbLevel = vlevel, autograde = autograde)
+    t = Tracer(qtest = prog, verbLevel = vlevel, autograde = autograde, backend = backend,
+               compiled = compiled)
     t.run(tid)
 
 if __name__ == "__main__":
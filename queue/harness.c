@@ -1,11 +1,19 @@
 /* Test support code */
 
+/* For SIGEV_THREAD_ID and gettid */
+#define _GNU_SOURCE
+
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
 #include <string.h>
 #include <setjmp.h>
 #include <signal.h>
+#include <time.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include "report.h"
 
@@ -43,29 +51,364 @@ typedef struct BELE {
 
 static block_ele_t *allocated = NULL;
 static size_t allocated_count = 0;
+
+/*
+  Set of allocated blocks, so that cautious mode can check a block in
+  constant time rather than by walking the list.  Open addressing with
+  linear probing, kept at most half full.
+*/
+static block_ele_t **live_set = NULL;
+static size_t live_capacity = 0;  /* Power of two */
+static int live_shift = 64;       /* 64 - log2(live_capacity) */
+
 /* Percent probability of malloc failure */
 int fail_probability = 0;
+int fail_seed = 1;
 static bool cautious_mode = true;
 static bool error_occurred = false;
 static char *error_message = "";
 
-static int time_limit = 1;
+/* Time limit for each guarded operation, in microseconds */
+int time_limit_us = 1000000;
 
 /*
  * Data for managing exceptions
  */
-static jmp_buf env;
+static sigjmp_buf env;
 static volatile sig_atomic_t jmp_ready = false;
-static bool time_limited = false;
+static volatile sig_atomic_t time_limited = false;
+
+/*
+  Watchdog.  One periodic timer, delivering SIGALRM to the thread that
+  runs the commands, ticks WATCHDOG_TICKS times per time limit, but
+  never more often than every WATCHDOG_MIN_TICK.  Starting an operation
+  only reads the clock (through the vDSO, so without a system call) and
+  bumps guard_seq; a tick that finds an operation running for longer
+  than the limit declares a timeout, so a limit is enforced to within
+  one tick.  After WATCHDOG_TICKS ticks in which no operation started
+  the timer stops, and the next operation restarts it.
+*/
+#define WATCHDOG_TICKS 4
+/* Shortest tick, in microseconds */
+#define WATCHDOG_MIN_TICK 1000
+/* Delay before checking again when a timeout finds malloc running */
+#define WATCHDOG_RETRY 50
+
+/* Older C libraries leave this field unnamed */
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+static timer_t watchdog;
+static bool watchdog_created = false;
+static bool watchdog_failed = false;     /* Use alarm instead */
+static volatile sig_atomic_t watchdog_idle = true;
+static long watchdog_tick;
+static volatile int64_t op_start_us = 0;    /* Set before time_limited */
+static volatile sig_atomic_t guard_seq = 0;
+static sig_atomic_t guard_seen = 0;
+static int guard_ticks = 0;
+static volatile sig_atomic_t in_allocator = false;
 
 
 /*
   Internal functions
  */
-/* Should this allocation fail? */
-static bool fail_allocation() {
-    double weight = (double) random() / RAND_MAX;
-    return (weight < 0.01 * fail_probability);
+/*
+  Fault injection state.  The generator is SplitMix64, so a seed gives
+  the same sequence everywhere, independent of the C library's random()
+*/
+typedef enum { RULE_NTH, RULE_EVERY, RULE_PERCENT } rule_mode_t;
+static char *rule_mode_name[] = { "nth", "every", "percent" };
+
+typedef struct {
+    char site[64];          /* Function name, or empty for any */
+    rule_mode_t mode;
+    unsigned long value;
+    unsigned long count;    /* Allocations it has seen */
+} fault_rule_t;
+
+#define MAX_RULES 32
+static fault_rule_t rules[MAX_RULES];
+static int rule_cnt = 0;
+
+static uint64_t fault_state = 1;
+static unsigned long alloc_index = 0;
+static unsigned long injected_cnt = 0;
+static bool fault_suspended = false;
+
+/* Most recent injected failures */
+#define FAULT_HISTORY 8
+static struct {
+    unsigned long index;
+    const char *site;
+    size_t size;
+} fault_history[FAULT_HISTORY];
+
+static uint64_t fault_random() {
+    uint64_t z = (fault_state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+void fault_suspend() {
+    fault_suspended = true;
+}
+
+void fault_resume() {
+    fault_suspended = false;
+}
+
+void fault_reset() {
+    int i;
+    fault_state = (uint64_t) fail_seed;
+    alloc_index = 0;
+    injected_cnt = 0;
+    for (i = 0; i < rule_cnt; i++)
+	rules[i].count = 0;
+}
+
+/* Fill in rule r.  Return false if mode or value is invalid */
+static bool parse_rule(fault_rule_t *r, char *site, char *mode, char *value) {
+    char *end;
+    int m;
+    for (m = RULE_NTH; m <= RULE_PERCENT && strcmp(mode, rule_mode_name[m]); m++)
+	;
+    unsigned long v = strtoul(value, &end, 0);
+    if (m > RULE_PERCENT || *end != '\0' || (m == RULE_PERCENT && v > 100)
+	|| (m != RULE_PERCENT && v == 0))
+	return false;
+    r->site[0] = '\0';
+    if (site && strcmp(site, "*") != 0) {
+	strncpy(r->site, site, sizeof(r->site) - 1);
+	r->site[sizeof(r->site) - 1] = '\0';
+    }
+    r->mode = m;
+    r->value = v;
+    r->count = 0;
+    return true;
+}
+
+bool fault_add_rule(char *site, char *mode, char *value) {
+    if (rule_cnt == MAX_RULES || !parse_rule(&rules[rule_cnt], site, mode, value))
+	return false;
+    rule_cnt++;
+    return true;
+}
+
+void fault_clear() {
+    rule_cnt = 0;
+}
+
+/* Parse integer in [lo, hi].  Return false if s is not one */
+static bool parse_bounded(char *s, long lo, long hi, int *val) {
+    char *end;
+    errno = 0;
+    long v = strtol(s, &end, 0);
+    if (errno || *end != '\0' || end == s || v < lo || v > hi)
+	return false;
+    *val = (int) v;
+    return true;
+}
+
+bool fault_load(char *fname) {
+    FILE *fp = fopen(fname, "r");
+    if (!fp) {
+	report(1, "Couldn't open fault schedule '%s'", fname);
+	return false;
+    }
+    /* Nothing changes unless the whole file is valid */
+    static fault_rule_t new_rules[MAX_RULES];
+    int new_cnt = 0;
+    int seed = fail_seed;
+    int probability = fail_probability;
+    char line[256];
+    int lineno = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), fp)) {
+	char *tok[4];
+	int ntok = 0;
+	char *save;
+	char *t = strtok_r(line, " \t\r\n", &save);
+	lineno++;
+	while (t && ntok < 4 && t[0] != '#') {
+	    tok[ntok++] = t;
+	    t = strtok_r(NULL, " \t\r\n", &save);
+	}
+	if (ntok == 0)
+	    continue;
+	if (ntok == 2 && strcmp(tok[0], "seed") == 0)
+	    ok = parse_bounded(tok[1], INT_MIN, INT_MAX, &seed);
+	else if (ntok == 2 && strcmp(tok[0], "malloc") == 0)
+	    ok = parse_bounded(tok[1], 0, 100, &probability);
+	else if (ntok < 2 || ntok > 3 || new_cnt == MAX_RULES)
+	    ok = false;
+	else
+	    ok = parse_rule(&new_rules[new_cnt++], ntok == 3 ? tok[0] : NULL,
+			    tok[ntok - 2], tok[ntok - 1]);
+	if (!ok)
+	    report(1, "%s:%d: Invalid fault rule", fname, lineno);
+    }
+    fclose(fp);
+    if (!ok)
+	return false;
+    memcpy(rules, new_rules, new_cnt * sizeof(fault_rule_t));
+    rule_cnt = new_cnt;
+    fail_seed = seed;
+    fail_probability = probability;
+    fault_reset();
+    return true;
+}
+
+void fault_show() {
+    int i;
+    report(1, "Seed %d, malloc %d%%: %lu allocations, %lu failures injected",
+	   fail_seed, fail_probability, alloc_index, injected_cnt);
+    for (i = 0; i < rule_cnt; i++)
+	report(1, "  %s %s %lu (%lu allocations seen)",
+	       rules[i].site[0] ? rules[i].site : "*",
+	       rule_mode_name[rules[i].mode], rules[i].value, rules[i].count);
+    unsigned long n = injected_cnt < FAULT_HISTORY ? injected_cnt : FAULT_HISTORY;
+    unsigned long k;
+    for (k = injected_cnt - n; k < injected_cnt; k++)
+	report(1, "  Failed allocation #%lu of %lu bytes in %s",
+	       fault_history[k % FAULT_HISTORY].index,
+	       (unsigned long) fault_history[k % FAULT_HISTORY].size,
+	       fault_history[k % FAULT_HISTORY].site);
+}
+
+/* Should this allocation fail?  Logs it if so */
+static bool fail_allocation(size_t size, const char *site) {
+    int i;
+    fault_rule_t *hit = NULL;
+    /* Invisible to the numbering, rules, and generator */
+    if (fault_suspended)
+	return false;
+    alloc_index++;
+    for (i = 0; i < rule_cnt; i++) {
+	fault_rule_t *r = &rules[i];
+	bool fail = false;
+	if (r->site[0] && strcmp(r->site, site) != 0)
+	    continue;
+	r->count++;
+	switch (r->mode) {
+	case RULE_NTH:
+	    fail = r->count == r->value;
+	    break;
+	case RULE_EVERY:
+	    fail = r->count % r->value == 0;
+	    break;
+	case RULE_PERCENT:
+	    fail = fault_random() % 100 < r->value;
+	    break;
+	}
+	if (fail && !hit)
+	    hit = r;
+    }
+    bool fail = hit != NULL;
+    if (!fail && fail_probability > 0)
+	fail = fault_random() % 10000 < 100 * (uint64_t) fail_probability;
+    if (fail) {
+	int h = injected_cnt++ % FAULT_HISTORY;
+	fault_history[h].index = alloc_index;
+	fault_history[h].site = site;
+	fault_history[h].size = size;
+	if (hit)
+	    report_event(MSG_WARN, "Malloc returning NULL: allocation #%lu "
+			 "(%lu bytes) in %s, by rule %s %s %lu",
+			 alloc_index, (unsigned long) size, site,
+			 hit->site[0] ? hit->site : "*",
+			 rule_mode_name[hit->mode], hit->value);
+	else
+	    report_event(MSG_WARN, "Malloc returning NULL: allocation #%lu "
+			 "(%lu bytes) in %s, seed %d",
+			 alloc_index, (unsigned long) size, site, fail_seed);
+    }
+    return fail;
+}
+
+/* Home slot of block: Fibonacci hashing of its address */
+static inline size_t live_home(block_ele_t *b) {
+    return (size_t) (((uint64_t) (uintptr_t) b * 0x9E3779B97F4A7C15ULL)
+		     >> live_shift);
+}
+
+/* Slot holding b, or live_capacity if b is not in the set */
+static size_t live_find(block_ele_t *b) {
+    if (live_capacity == 0)
+	return 0;
+    size_t mask = live_capacity - 1;
+    size_t i;
+    for (i = live_home(b); live_set[i]; i = (i + 1) & mask)
+	if (live_set[i] == b)
+	    return i;
+    return live_capacity;
+}
+
+static void live_insert(block_ele_t *b);
+
+/*
+  Double the capacity of the set (or create it) and rehash.  If there is
+  no memory for the new table, keep the old one and return false
+*/
+static bool live_grow() {
+    size_t cap = live_capacity ? 2 * live_capacity : 1024;
+    block_ele_t **set = calloc(cap, sizeof(block_ele_t *));
+    if (set == NULL)
+	return false;
+    block_ele_t **old = live_set;
+    size_t oldcap = live_capacity;
+    live_set = set;
+    live_capacity = cap;
+    live_shift = 64;
+    size_t c;
+    for (c = live_capacity; c > 1; c >>= 1)
+	live_shift--;
+    size_t i;
+    for (i = 0; i < oldcap; i++)
+	if (old[i])
+	    live_insert(old[i]);
+    free(old);
+    return true;
+}
+
+/* Add newly allocated block.  Call before counting it */
+static void live_insert(block_ele_t *b) {
+    /* A fuller table is slower, but works while it has a free slot */
+    if (2 * (allocated_count + 1) > live_capacity && !live_grow()
+	&& allocated_count + 1 >= live_capacity) {
+	report_event(MSG_FATAL, "Couldn't allocate any more memory");
+	error_occurred = true;
+	return;
+    }
+    size_t mask = live_capacity - 1;
+    size_t i = live_home(b);
+    while (live_set[i])
+	i = (i + 1) & mask;
+    live_set[i] = b;
+}
+
+/*
+  Remove the block in slot i, shifting later blocks of the same probe
+  run back so that no lookup stops early at the hole
+*/
+static void live_remove(size_t i) {
+    size_t mask = live_capacity - 1;
+    size_t j = i;
+    for (;;) {
+	j = (j + 1) & mask;
+	if (!live_set[j])
+	    break;
+	size_t k = live_home(live_set[j]);
+	/* Move it unless its home lies cyclically in (i, j] */
+	bool stays = i <= j ? (i < k && k <= j) : (i < k || k <= j);
+	if (!stays) {
+	    live_set[i] = live_set[j];
+	    i = j;
+	}
+    }
+    live_set[i] = NULL;
 }
 
 /*
@@ -80,13 +423,7 @@ static block_ele_t *find_header(void *p) {
     block_ele_t *b = (block_ele_t *) ((size_t) p - sizeof(block_ele_t));
     if (cautious_mode) {
 	/* Make sure this is really an allocated block */
-	block_ele_t *ab = allocated;
-	bool found = false;
-	while (ab && !found) {
-	    found = ab == b;
-	    ab = ab->next;
-	}
-	if (!found) {
+	if (live_find(b) == live_capacity) {
 	    report_event(MSG_ERROR, "Attempted to free unallocated block.  Address = %p", p);
 	    error_occurred = true;
 	}
@@ -110,10 +447,13 @@ static size_t *find_footer(block_ele_t *b) {
  */
 void *test_malloc(size_t size)
 {
-    if (fail_allocation()) {
-	report_event(MSG_WARN, "Malloc returning NULL");
+    return test_malloc_site(size, "?");
+}
+
+static void *malloc_block(size_t size, const char *site)
+{
+    if (fail_allocation(size, site ? site : "?"))
 	return NULL;
-    }
     block_ele_t *new_block = malloc(size + sizeof(block_ele_t) + sizeof(size_t));
     if (new_block == NULL) {
 	report_event(MSG_FATAL, "Couldn't allocate any more memory");
@@ -124,6 +464,7 @@ void *test_malloc(size_t size)
     *find_footer(new_block) = MAGICFOOTER;
     void *p = (void *) &new_block->payload;
     memset(p, FILLCHAR, size);
+    live_insert(new_block);
     new_block->next = allocated;
     new_block->prev = NULL;
     if (allocated)
@@ -133,7 +474,7 @@ void *test_malloc(size_t size)
     return p;
 }
 
-void test_free(void *p)
+static void release_block(void *p)
 {
     if (p == NULL) {
 	report(MSG_ERROR, "Attempt to free NULL");
@@ -151,6 +492,10 @@ void test_free(void *p)
     *find_footer(b) = MAGICFREE;
     memset(p, FILLCHAR, b->payload_size);
     
+    size_t slot = live_find(b);
+    if (slot < live_capacity)
+	live_remove(slot);
+
     /* Unlink from list */
     block_ele_t *bn = b->next;
     block_ele_t *bp = b->prev;
@@ -165,6 +510,25 @@ void test_free(void *p)
     allocated_count --;
 }
 
+/*
+  The C library's allocator must not be left by longjmp, so the watchdog
+  holds back a timeout until these return
+*/
+void *test_malloc_site(size_t size, const char *site)
+{
+    in_allocator = true;
+    void *p = malloc_block(size, site);
+    in_allocator = false;
+    return p;
+}
+
+void test_free(void *p)
+{
+    in_allocator = true;
+    release_block(p);
+    in_allocator = false;
+}
+
 size_t allocation_check() {
     return allocated_count;
 }
@@ -192,18 +556,120 @@ bool error_check() {
     return e;
 }
 
+/* Create the timer.  Return false if there is none, so use alarm */
+static bool watchdog_create() {
+    if (watchdog_created || watchdog_failed)
+	return watchdog_created;
+    struct sigevent sev;
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.sigev_signo = SIGALRM;
+    sev.sigev_notify_thread_id = gettid();
+    if (timer_create(CLOCK_MONOTONIC, &sev, &watchdog) != 0) {
+	report(1, "Could not create watchdog timer.  Using alarm");
+	watchdog_failed = true;
+	return false;
+    }
+    watchdog_created = true;
+    return true;
+}
+
+/* Set timer to fire after usec, then every period usec (0 for once) */
+static void watchdog_set(long usec, long period) {
+    struct itimerspec its;
+    its.it_value.tv_sec = usec / 1000000;
+    its.it_value.tv_nsec = (usec % 1000000) * 1000;
+    its.it_interval.tv_sec = period / 1000000;
+    its.it_interval.tv_nsec = (period % 1000000) * 1000;
+    timer_settime(watchdog, 0, &its, NULL);
+}
+
+/* Monotonic time in microseconds */
+static int64_t monotonic_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Start the watchdog ticking */
+static void watchdog_arm() {
+    watchdog_tick = time_limit_us / WATCHDOG_TICKS;
+    if (watchdog_tick < WATCHDOG_MIN_TICK)
+	watchdog_tick = WATCHDOG_MIN_TICK;
+    guard_seen = guard_seq;
+    guard_ticks = 0;
+    watchdog_idle = false;
+    watchdog_set(watchdog_tick, watchdog_tick);
+}
+
+/* Stop the timer.  Called from the signal handler, too */
+static void watchdog_disarm() {
+    watchdog_idle = true;
+    if (watchdog_created)
+	watchdog_set(0, 0);
+}
+
+void watchdog_reset() {
+    watchdog_disarm();
+}
+
+bool watchdog_expired() {
+    if (watchdog_failed)
+	/* Came from alarm, which is only set for a guarded operation */
+	return true;
+    if (guard_seq != guard_seen || time_limited) {
+	guard_seen = guard_seq;
+	guard_ticks = 0;
+	if (!time_limited || monotonic_us() - op_start_us < time_limit_us)
+	    return false;
+	if (in_allocator) {
+	    /* Out of time, but in malloc or free.  Look again shortly */
+	    watchdog_set(WATCHDOG_RETRY, watchdog_tick);
+	    return false;
+	}
+	return true;
+    }
+    if (++guard_ticks >= WATCHDOG_TICKS)
+	watchdog_disarm();
+    return false;
+}
+
+/* Start timing a guarded operation */
+static void limit_start() {
+    op_start_us = monotonic_us();
+    guard_seq++;
+    time_limited = true;
+    if (!watchdog_create())
+	alarm((time_limit_us + 999999) / 1000000);
+    else if (watchdog_idle)
+	watchdog_arm();
+}
+
+/* Done timing it.  A ticking watchdog is left running */
+static void limit_stop() {
+    if (!time_limited)
+	return;
+    time_limited = false;
+    if (watchdog_failed)
+	alarm(0);
+}
+
 /*
  * Prepare for a risky operation using setjmp.
  * Function returns true for initial return, false for error return
  */
 bool exception_setup(bool limit_time) {
-    if (sigsetjmp(env, 1)) {
+    /* The mask is not saved, so unblock the handlers' signals by hand */
+    if (sigsetjmp(env, 0)) {
 	/* Got here from longjmp */
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGALRM);
+	sigaddset(&set, SIGSEGV);
+	pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+	in_allocator = false;
 	jmp_ready = false;
-	if (time_limited) {
-	    alarm(0);
-	    time_limited = false;
-	}
+	limit_stop();
 	if (error_message) {
 	    report_event(MSG_ERROR, error_message);
 	}
@@ -212,10 +678,8 @@ bool exception_setup(bool limit_time) {
     } else {
 	/* Got here from initial call */
 	jmp_ready = true;
-	if (limit_time) {
-	    alarm(time_limit);
-	    time_limited = true;
-	}
+	if (limit_time && time_limit_us > 0)
+	    limit_start();
 	return true;
     }
 }
@@ -224,10 +688,7 @@ bool exception_setup(bool limit_time) {
  * Call once past risky code
  */
 void exception_cancel() {
-    if (time_limited) {
-	alarm(0);
-	time_limited = false;
-    }
+    limit_stop();
     jmp_ready = false;
     error_message = "";
 }
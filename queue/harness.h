@@ -11,6 +11,9 @@
 void *test_malloc(size_t size);
 void test_free(void *p);
 
+/* Allocate on behalf of function site, which fault injection can target */
+void *test_malloc_site(size_t size, const char *site);
+
 #ifdef INTERNAL
 /* Report number of allocated blocks */
 size_t allocation_check();
@@ -18,6 +21,45 @@ size_t allocation_check();
 /* Probability of malloc failing, expressed as percent */
 extern int fail_probability;
 
+/*
+  Fault injection.  Failures are drawn from a generator seeded with
+  fail_seed, and from rules, each of which applies to every allocation
+  or only to those made by one function (site):
+    nth N      fail its Nth allocation
+    every N    fail every Nth allocation
+    percent P  fail with probability P percent
+  Allocations are numbered from the last reset, and each injected
+  failure is reported with its number and site.
+*/
+extern int fail_seed;
+
+/* Restart generator from fail_seed and numbering from 1 */
+void fault_reset();
+
+/* Add rule.  site is NULL or "*" for any.  Return false if invalid */
+bool fault_add_rule(char *site, char *mode, char *value);
+
+/* Remove all rules */
+void fault_clear();
+
+/*
+  Replace rules with those in schedule file, one per line:
+  "[site] mode value", "seed N" (sets fail_seed), or "malloc P" (sets
+  fail_probability).  Then reset.  Return false, changing nothing, if
+  any line is invalid
+*/
+bool fault_load(char *fname);
+
+/* Report rules, counts, and the most recent injected failures */
+void fault_show();
+
+/*
+  Stop injecting failures, as for a benchmark, and start again.
+  Allocations in between don't count towards rules or numbering
+*/
+void fault_suspend();
+void fault_resume();
+
 /*
   Set/unset cautious mode.
   In this mode, makes extra sure any block to be freed is currently allocated.
@@ -29,6 +71,24 @@ void set_cautious_mode(bool cautious);
  */
 bool error_check();
 
+/*
+  Time limit for each guarded operation, in microseconds.  0 for none.
+  Enforced by a watchdog timer that is set once for a run of operations
+  rather than for each one; it ticks at a quarter of the limit, or every
+  millisecond for limits under 4 ms, so a timeout is detected within
+  the limit plus one tick.
+*/
+extern int time_limit_us;
+
+/* Stop the watchdog, so the next operation restarts it with a new limit */
+void watchdog_reset();
+
+/*
+  For the SIGALRM handler: return whether the current operation has
+  run out of time
+*/
+bool watchdog_expired();
+
 /*
  * Prepare for a risky operation using setjmp.
  * Function returns true for initial return, false for error return
@@ -48,6 +108,6 @@ void trigger_exception(char *msg);
 
 #else
 /* Tested program use our versions of malloc and free */
-#define malloc test_malloc
+#define malloc(size) test_malloc_site((size), __func__)
 #define free test_free
 #endif
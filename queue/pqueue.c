@@ -0,0 +1,198 @@
+/*
+ * Priority queue as a 4-ary array heap with decrease-key (see pqueue.h)
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "harness.h"
+#include "pqueue.h"
+
+/* Heap capacity when the first key is inserted */
+#define PQ_INIT 16
+
+/* Children of slot i are D*i+1 .. D*i+D */
+#define D 4
+
+/* Replace *arrp by a copy with room for newcap ints */
+static bool grow_array(int **arrp, int oldcap, int newcap)
+{
+    int *a = malloc(newcap * sizeof(int));
+    if (!a)
+	return false;
+    if (*arrp) {
+	memcpy(a, *arrp, oldcap * sizeof(int));
+	free(*arrp);
+    }
+    *arrp = a;
+    return true;
+}
+
+/* Put key with handle h into slot i */
+static inline void place(pqueue_t *pq, int i, int key, pq_handle_t h)
+{
+    pq->keys[i] = key;
+    pq->id[i] = h;
+    pq->slot[h] = i;
+}
+
+/* Move key with handle h up from hole i to its place */
+static void sift_up(pqueue_t *pq, int i, int key, pq_handle_t h)
+{
+    while (i > 0) {
+	int parent = (i - 1) / D;
+	if (pq->keys[parent] <= key)
+	    break;
+	place(pq, i, pq->keys[parent], pq->id[parent]);
+	i = parent;
+    }
+    place(pq, i, key, h);
+}
+
+/* Move key with handle h down from hole i to its place */
+static void sift_down(pqueue_t *pq, int i, int key, pq_handle_t h)
+{
+    int n = pq->size;
+    for (;;) {
+	int first = D * i + 1;
+	if (first >= n)
+	    break;
+	int last = first + D < n ? first + D : n;
+	int best = first;
+	int c;
+	for (c = first + 1; c < last; c++)
+	    if (pq->keys[c] < pq->keys[best])
+		best = c;
+	if (key <= pq->keys[best])
+	    break;
+	place(pq, i, pq->keys[best], pq->id[best]);
+	i = best;
+    }
+    place(pq, i, key, h);
+}
+
+/*
+  Create empty priority queue.
+  Return NULL if could not allocate space.
+*/
+pqueue_t *pq_new()
+{
+    pqueue_t *pq = malloc(sizeof(pqueue_t));
+    if (!pq)
+	return NULL;
+    pq->keys = NULL;
+    pq->id = NULL;
+    pq->size = 0;
+    pq->capacity = 0;
+    pq->slot = NULL;
+    pq->nhandles = 0;
+    pq->free_handle = -1;
+    return pq;
+}
+
+/* Free all storage used by priority queue */
+void pq_free(pqueue_t *pq)
+{
+    if (!pq)
+	return;
+    if (pq->keys)
+	free(pq->keys);
+    if (pq->id)
+	free(pq->id);
+    if (pq->slot)
+	free(pq->slot);
+    free(pq);
+}
+
+/*
+  Attempt to insert key.
+  Return true if successful, storing its handle at *hp if hp non-NULL.
+  Return false if pq is NULL or could not allocate space.
+
+  A new handle is only needed when the free list is empty, in which
+  case every handle is in the heap and nhandles == size.  So the slot
+  array always has the same capacity as the heap.
+*/
+bool pq_insert(pqueue_t *pq, int key, pq_handle_t *hp)
+{
+    if (!pq)
+	return false;
+    if (pq->size == pq->capacity) {
+	int newcap = pq->capacity ? 2 * pq->capacity : PQ_INIT;
+	/* Arrays grown before a failure simply keep their extra room */
+	if (!grow_array(&pq->keys, pq->capacity, newcap)
+	    || !grow_array(&pq->id, pq->capacity, newcap)
+	    || !grow_array(&pq->slot, pq->capacity, newcap))
+	    return false;
+	pq->capacity = newcap;
+    }
+    pq_handle_t h;
+    if (pq->free_handle >= 0) {
+	h = pq->free_handle;
+	pq->free_handle = -2 - pq->slot[h];
+    } else {
+	h = pq->nhandles++;
+    }
+    pq->size++;
+    sift_up(pq, pq->size - 1, key, h);
+    if (hp)
+	*hp = h;
+    return true;
+}
+
+/*
+  Store smallest key at *kp without removing it.
+  Return false if pq is NULL or empty.
+*/
+bool pq_peek(pqueue_t *pq, int *kp)
+{
+    if (!pq || pq->size == 0)
+	return false;
+    *kp = pq->keys[0];
+    return true;
+}
+
+/*
+  Remove smallest key.
+  Return false if pq is NULL or empty.
+  If kp non-NULL, store removed key at *kp.
+*/
+bool pq_pop_min(pqueue_t *pq, int *kp)
+{
+    if (!pq || pq->size == 0)
+	return false;
+    if (kp)
+	*kp = pq->keys[0];
+    pq_handle_t h = pq->id[0];
+    pq->slot[h] = -2 - pq->free_handle;
+    pq->free_handle = h;
+    pq->size--;
+    if (pq->size > 0)
+	sift_down(pq, 0, pq->keys[pq->size], pq->id[pq->size]);
+    return true;
+}
+
+/*
+  Lower the key of the element with handle h to key.
+  Return false if pq is NULL, h is not a live handle,
+  or key is larger than the current key.
+*/
+bool pq_decrease_key(pqueue_t *pq, pq_handle_t h, int key)
+{
+    if (!pq || h < 0 || h >= pq->nhandles || pq->slot[h] < 0)
+	return false;
+    int i = pq->slot[h];
+    if (key > pq->keys[i])
+	return false;
+    sift_up(pq, i, key, h);
+    return true;
+}
+
+/*
+  Return number of keys in priority queue.
+  Return 0 if pq is NULL or empty
+*/
+int pq_size(pqueue_t *pq)
+{
+    return pq ? pq->size : 0;
+}
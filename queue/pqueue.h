@@ -0,0 +1,76 @@
+/*
+ * Priority queue of int keys, smallest first.
+ *
+ * Keys are kept in an implicit 4-ary min-heap: the children of slot i
+ * are slots 4i+1 .. 4i+4, so a sift-down compares four keys that share
+ * one cache line and the tree is half as deep as a binary heap.
+ *
+ * Each inserted key gets a handle that stays valid until the key is
+ * popped, for use with pq_decrease_key.  Handles of popped keys are
+ * reused by later inserts.
+ */
+
+#include <stdbool.h>
+
+/* Names an element for decrease-key */
+typedef int pq_handle_t;
+
+/* Priority queue structure */
+typedef struct {
+    int *keys;       /* Heap-ordered keys */
+    pq_handle_t *id; /* Handle of the key in each heap slot */
+    int size;
+    int capacity;
+    /*
+      Heap slot of each handle.  Unused handles form a free list:
+      slot[h] == -2 - next, with next == -1 ending the list.
+    */
+    int *slot;
+    int nhandles;
+    int free_handle;
+} pqueue_t;
+
+/*
+  Create empty priority queue.
+  Return NULL if could not allocate space.
+*/
+pqueue_t *pq_new();
+
+/*
+  Free all storage used by priority queue.
+  No effect if pq is NULL
+*/
+void pq_free(pqueue_t *pq);
+
+/*
+  Attempt to insert key.
+  Return true if successful, storing its handle at *hp if hp non-NULL.
+  Return false if pq is NULL or could not allocate space.
+*/
+bool pq_insert(pqueue_t *pq, int key, pq_handle_t *hp);
+
+/*
+  Store smallest key at *kp without removing it.
+  Return false if pq is NULL or empty.
+*/
+bool pq_peek(pqueue_t *pq, int *kp);
+
+/*
+  Remove smallest key.
+  Return false if pq is NULL or empty.
+  If kp non-NULL, store removed key at *kp.
+*/
+bool pq_pop_min(pqueue_t *pq, int *kp);
+
+/*
+  Lower the key of the element with handle h to key.
+  Return false if pq is NULL, h is not a live handle,
+  or key is larger than the current key.
+*/
+bool pq_decrease_key(pqueue_t *pq, pq_handle_t h, int key);
+
+/*
+  Return number of keys in priority queue.
+  Return 0 if pq is NULL or empty
+*/
+int pq_size(pqueue_t *pq);
@@ -0,0 +1,358 @@
+/*
+ * Parallel trace runner for qtest.
+ *
+ * Runs each trace in its own qtest process, as many at once as there
+ * are processors (or -j JOBS).  Every process gets CPU time and address
+ * space limits through setrlimit, on top of the per-operation alarm in
+ * the harness, so a runaway trace is killed rather than stalling the
+ * run.  wait4 supplies each trace's CPU time and peak resident memory.
+ * Prints a score table like driver.py and, with -o, a JSON summary.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <getopt.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define TRACE_DIR "./traces"
+
+/* Traces and their points.  Keep in step with driver.py */
+typedef struct {
+    int id;
+    char *name;
+    int max_score;
+} trace_t;
+
+static trace_t traces[] = {
+    {  1, "trace-01-ops", 7 },     {  2, "trace-02-ops", 7 },
+    {  3, "trace-03-ops", 7 },     {  4, "trace-04-ops", 7 },
+    {  5, "trace-05-ops", 7 },     {  6, "trace-06-robust", 7 },
+    {  7, "trace-07-robust", 7 },  {  8, "trace-08-robust", 7 },
+    {  9, "trace-09-malloc", 7 },  { 10, "trace-10-malloc", 7 },
+    { 11, "trace-11-malloc", 7 },  { 12, "trace-12-perf", 7 },
+    { 13, "trace-13-perf", 8 },    { 14, "trace-14-perf", 8 },
+    { 15, "trace-15-perf", 8 },    { 16, "trace-16-ops", 7 },
+    { 17, "trace-17-perf", 8 },    { 18, "trace-18-ops", 7 },
+    { 19, "trace-19-perf", 8 },    { 20, "trace-20-ops", 7 },
+    { 21, "trace-21-perf", 8 },    { 22, "trace-22-ops", 7 },
+    { 23, "trace-23-perf", 8 },    { 24, "trace-24-ops", 7 },
+    { 25, "trace-25-malloc", 7 },  { 26, "trace-26-perf", 8 },
+};
+#define NTRACES (sizeof(traces) / sizeof(traces[0]))
+
+/* Outcome of one trace */
+typedef struct {
+    pid_t pid;            /* While running */
+    bool run;             /* Counted in the score */
+    bool started;         /* False if it could not be started */
+    bool ok;
+    int status;           /* From wait4 */
+    double start;
+    double wall;          /* Seconds */
+    double cpu;           /* User plus system seconds */
+    long maxrss_kb;
+    FILE *out;            /* Captured output, when verbose */
+} result_t;
+
+static result_t results[NTRACES];
+
+/* Settings */
+static char *qtest = "./qtest";
+static int verblevel = 0;
+static char *backend = NULL;
+static int cpu_limit = 10;        /* Seconds per trace */
+static int mem_limit = 2048;      /* Megabytes of address space per trace */
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1.0E-9 * ts.tv_nsec;
+}
+
+/* Count trace as failed without running it */
+static void not_started(result_t *r)
+{
+    r->run = true;
+    r->started = false;
+    r->ok = false;
+    if (r->out)
+	fclose(r->out);
+    r->out = NULL;
+}
+
+/* Start qtest on trace i.  Return false if it could not be started */
+static bool launch(int i)
+{
+    result_t *r = &results[i];
+    char fname[256], vname[16];
+    snprintf(fname, sizeof(fname), "%s/%s.cmd", TRACE_DIR, traces[i].name);
+    snprintf(vname, sizeof(vname), "%d", verblevel);
+    r->out = verblevel > 0 ? tmpfile() : NULL;
+    r->start = now();
+    pid_t pid = fork();
+    if (pid < 0) {
+	perror("fork");
+	not_started(r);
+	return false;
+    }
+    if (pid == 0) {
+	/* Soft CPU limit sends SIGXCPU; the hard one a second later kills */
+	struct rlimit cpu = { cpu_limit, cpu_limit + 1 };
+	struct rlimit mem = { (rlim_t) mem_limit << 20, (rlim_t) mem_limit << 20 };
+	setrlimit(RLIMIT_CPU, &cpu);
+	setrlimit(RLIMIT_AS, &mem);
+	int fd = r->out ? fileno(r->out) : open("/dev/null", O_WRONLY);
+	dup2(fd, STDOUT_FILENO);
+	dup2(fd, STDERR_FILENO);
+	char *args[] = { qtest, "-v", vname, "-f", fname, NULL, NULL, NULL };
+	if (backend) {
+	    args[5] = "-q";
+	    args[6] = backend;
+	}
+	execv(qtest, args);
+	perror("execv");
+	_exit(127);
+    }
+    r->pid = pid;
+    r->run = true;
+    r->started = true;
+    return true;
+}
+
+/* Describe how trace ended */
+static void describe(result_t *r, char *buf, size_t len)
+{
+    if (!r->started)
+	snprintf(buf, len, "not started");
+    else if (r->pid != 0)
+	snprintf(buf, len, "lost");
+    else if (WIFEXITED(r->status))
+	snprintf(buf, len, "exit %d", WEXITSTATUS(r->status));
+    else if (WIFSIGNALED(r->status)) {
+	/* SIGKILL may be the hard CPU limit, or the OOM killer */
+	int sig = WTERMSIG(r->status);
+	snprintf(buf, len, "%s", sig == SIGXCPU ?
+		 "CPU limit exceeded" : strsignal(sig));
+    } else
+	snprintf(buf, len, "unknown");
+}
+
+/*
+  Wait for one of our traces to finish and record it.  Return false if
+  there are no children left to wait for
+*/
+static bool reap()
+{
+    int status;
+    struct rusage ru;
+    pid_t pid;
+    int i;
+    do {
+	pid = wait4(-1, &status, 0, &ru);
+	if (pid < 0 && errno != EINTR)
+	    return false;
+	for (i = 0; pid > 0 && i < NTRACES && results[i].pid != pid; i++)
+	    ;
+    } while (pid < 0 || i == NTRACES);
+    result_t *r = &results[i];
+    r->wall = now() - r->start;
+    r->status = status;
+    r->ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    r->cpu = ru.ru_utime.tv_sec + 1.0E-6 * ru.ru_utime.tv_usec
+	+ ru.ru_stime.tv_sec + 1.0E-6 * ru.ru_stime.tv_usec;
+    r->maxrss_kb = ru.ru_maxrss;
+    r->pid = 0;
+    if (r->out) {
+	char buf[4096];
+	size_t n;
+	printf("+++ TESTING trace %s:\n", traces[i].name);
+	rewind(r->out);
+	while ((n = fread(buf, 1, sizeof(buf), r->out)) > 0)
+	    fwrite(buf, 1, n, stdout);
+	fclose(r->out);
+	r->out = NULL;
+	fflush(stdout);
+    }
+    return true;
+}
+
+static void write_json(FILE *fp, int jobs, double wall)
+{
+    int score = 0, max_score = 0;
+    size_t i;
+    for (i = 0; i < NTRACES; i++) {
+	if (!results[i].run)
+	    continue;
+	max_score += traces[i].max_score;
+	score += results[i].ok ? traces[i].max_score : 0;
+    }
+    char bname[16] = "null";
+    if (backend)
+	snprintf(bname, sizeof(bname), "%ld", strtol(backend, NULL, 10));
+    fprintf(fp, "{\n  \"backend\": %s,\n  \"jobs\": %d,\n  \"wall\": %.3f,\n"
+	    "  \"score\": %d,\n  \"max_score\": %d,\n  \"traces\": [",
+	    bname, jobs, wall, score, max_score);
+    bool first = true;
+    for (i = 0; i < NTRACES; i++) {
+	result_t *r = &results[i];
+	char how[64];
+	if (!r->run)
+	    continue;
+	describe(r, how, sizeof(how));
+	fprintf(fp, "%s\n    { \"id\": %d, \"name\": \"%s\", \"ok\": %s, "
+		"\"score\": %d, \"max_score\": %d, \"status\": \"%s\", "
+		"\"wall\": %.3f, \"cpu\": %.3f, \"maxrss_kb\": %ld }",
+		first ? "" : ",", traces[i].id, traces[i].name,
+		r->ok ? "true" : "false",
+		r->ok ? traces[i].max_score : 0, traces[i].max_score, how,
+		r->wall, r->cpu, r->maxrss_kb);
+	first = false;
+    }
+    fprintf(fp, "\n  ]\n}\n");
+}
+
+static void usage(char *cmd)
+{
+    printf("Usage: %s [-h] [-p PROG] [-t TID] [-v VLEVEL] [-q BACKEND] [-j JOBS]\n"
+	   "\t\t[-c SECS] [-m MB] [-o FILE]\n", cmd);
+    printf("\t-h         Print this information\n");
+    printf("\t-p PROG    Program to test (default ./qtest)\n");
+    printf("\t-t TID     Run only trace TID\n");
+    printf("\t-v VLEVEL  Verbosity level for qtest; output shown when > 0\n");
+    printf("\t-q BACKEND Queue representation (0 = list, 1 = chunked, 2 = ring)\n");
+    printf("\t-j JOBS    Traces run at once (default: number of processors)\n");
+    printf("\t-c SECS    CPU time limit per trace\n");
+    printf("\t-m MB      Address space limit per trace, in megabytes\n");
+    printf("\t-o FILE    Write JSON summary to FILE (- for standard output)\n");
+    exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+    int jobs = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    int tid = 0;
+    char *json_name = NULL;
+    int c;
+
+    while ((c = getopt(argc, argv, "hp:t:v:q:j:c:m:o:")) != -1) {
+	switch (c) {
+	case 'p':
+	    qtest = optarg;
+	    break;
+	case 't':
+	    tid = atoi(optarg);
+	    break;
+	case 'v':
+	    verblevel = atoi(optarg);
+	    break;
+	case 'q': {
+	    char *end;
+	    strtol(optarg, &end, 10);
+	    if (*optarg == '\0' || *end != '\0') {
+		printf("ERROR: Invalid backend '%s'\n", optarg);
+		return 1;
+	    }
+	    backend = optarg;
+	    break;
+	}
+	case 'j':
+	    jobs = atoi(optarg);
+	    break;
+	case 'c':
+	    cpu_limit = atoi(optarg);
+	    break;
+	case 'm':
+	    mem_limit = atoi(optarg);
+	    break;
+	case 'o':
+	    json_name = optarg;
+	    break;
+	default:
+	    usage(argv[0]);
+	}
+    }
+    if (jobs < 1)
+	jobs = 1;
+    if (tid != 0) {
+	size_t i;
+	for (i = 0; i < NTRACES && traces[i].id != tid; i++)
+	    ;
+	if (i == NTRACES) {
+	    printf("ERROR: Invalid trace ID %d\n", tid);
+	    return 1;
+	}
+    }
+
+    double start = now();
+    int running = 0;
+    bool lost = false;
+    size_t i;
+    for (i = 0; i < NTRACES; i++) {
+	if (tid != 0 && traces[i].id != tid)
+	    continue;
+	if (running == jobs && !lost) {
+	    if (reap())
+		running--;
+	    else {
+		/* No children left to free a slot.  Launch no more */
+		perror("wait4");
+		lost = true;
+	    }
+	}
+	if (lost) {
+	    not_started(&results[i]);
+	    continue;
+	}
+	fflush(stdout);
+	if (launch(i))
+	    running++;
+    }
+    while (running > 0 && reap())
+	running--;
+    double wall = now() - start;
+
+    int score = 0, max_score = 0;
+    printf("---\tTrace\t\tPoints\tWall\tCPU\tMax RSS\n");
+    for (i = 0; i < NTRACES; i++) {
+	result_t *r = &results[i];
+	if (!r->run)
+	    continue;
+	int val = r->ok ? traces[i].max_score : 0;
+	printf("---\t%s\t%d/%d\t%.3f\t%.3f\t%ld KB", traces[i].name,
+	       val, traces[i].max_score, r->wall, r->cpu, r->maxrss_kb);
+	if (!r->ok) {
+	    char how[64];
+	    describe(r, how, sizeof(how));
+	    printf("\t(%s)", how);
+	}
+	printf("\n");
+	score += val;
+	max_score += traces[i].max_score;
+    }
+    printf("---\tTOTAL\t\t%d/%d\t%.3f\n", score, max_score, wall);
+
+    if (json_name) {
+	FILE *fp = strcmp(json_name, "-") == 0 ? stdout : fopen(json_name, "w");
+	if (!fp) {
+	    perror(json_name);
+	    return 1;
+	}
+	write_json(fp, jobs, wall);
+	if (fp != stdout)
+	    fclose(fp);
+    }
+    return score == max_score ? 0 : 1;
+}
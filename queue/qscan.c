@@ -0,0 +1,106 @@
+/*
+ * Vectorized scans over runs of values (see qscan.h).
+ * Four values per instruction with SSE2, one at a time otherwise.
+ */
+
+#include <stdbool.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "queue.h"
+#include "qscan.h"
+
+/* Index of first a[i] == v, or -1 */
+int qscan_first(const int *a, int n, int v)
+{
+    int i = 0;
+#ifdef __SSE2__
+    __m128i key = _mm_set1_epi32(v);
+    for (; i + 4 <= n; i += 4) {
+	__m128i x = _mm_loadu_si128((const __m128i *) &a[i]);
+	int m = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(x, key)));
+	if (m)
+	    return i + __builtin_ctz(m);
+    }
+#endif
+    for (; i < n; i++)
+	if (a[i] == v)
+	    return i;
+    return -1;
+}
+
+/* Index of last a[i] == v, or -1 */
+int qscan_last(const int *a, int n, int v)
+{
+    int i = n;
+#ifdef __SSE2__
+    __m128i key = _mm_set1_epi32(v);
+    for (; i >= 4; i -= 4) {
+	__m128i x = _mm_loadu_si128((const __m128i *) &a[i - 4]);
+	int m = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(x, key)));
+	if (m)
+	    return i - 4 + 31 - __builtin_clz(m);
+    }
+#endif
+    for (i--; i >= 0; i--)
+	if (a[i] == v)
+	    return i;
+    return -1;
+}
+
+/* Number of a[i] with (a[i] cmp v) */
+int qscan_count(const int *a, int n, q_cmp_t cmp, int v)
+{
+    int i = 0, cnt = 0;
+#ifdef __SSE2__
+    __m128i key = _mm_set1_epi32(v);
+    /* Matching lanes are -1, so subtracting counts them */
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 4 <= n; i += 4) {
+	__m128i x = _mm_loadu_si128((const __m128i *) &a[i]);
+	__m128i m;
+	switch (cmp) {
+	case Q_EQ: m = _mm_cmpeq_epi32(x, key); break;
+	case Q_LT: m = _mm_cmplt_epi32(x, key); break;
+	case Q_GT: m = _mm_cmpgt_epi32(x, key); break;
+	/* The others count the complement */
+	case Q_NE: m = _mm_cmpeq_epi32(x, key); break;
+	case Q_LE: m = _mm_cmpgt_epi32(x, key); break;
+	default:   m = _mm_cmplt_epi32(x, key); break;
+	}
+	acc = _mm_sub_epi32(acc, m);
+    }
+    int lanes[4];
+    _mm_storeu_si128((__m128i *) lanes, acc);
+    cnt = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    if (cmp == Q_NE || cmp == Q_LE || cmp == Q_GE)
+	cnt = i - cnt;
+#endif
+    for (; i < n; i++)
+	cnt += cmp_holds(a[i], cmp, v);
+    return cnt;
+}
+
+/* Sum of a[0] .. a[n-1] */
+long long qscan_sum(const int *a, int n)
+{
+    int i = 0;
+    long long sum = 0;
+#ifdef __SSE2__
+    /* Sign extend pairs of values into 64-bit lanes */
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 4 <= n; i += 4) {
+	__m128i x = _mm_loadu_si128((const __m128i *) &a[i]);
+	__m128i sign = _mm_srai_epi32(x, 31);
+	acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(x, sign));
+	acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(x, sign));
+    }
+    long long lanes[2];
+    _mm_storeu_si128((__m128i *) lanes, acc);
+    sum = lanes[0] + lanes[1];
+#endif
+    for (; i < n; i++)
+	sum += a[i];
+    return sum;
+}
@@ -0,0 +1,30 @@
+/*
+ * Scans over runs of consecutive int values, used by the query
+ * operations of chunked and circular array queues.  Built with
+ * optimization, since the SSE2 loops gain little without it.
+ */
+
+/* Is x cmp v? */
+static inline bool cmp_holds(int x, q_cmp_t cmp, int v)
+{
+    switch (cmp) {
+    case Q_EQ: return x == v;
+    case Q_NE: return x != v;
+    case Q_LT: return x < v;
+    case Q_LE: return x <= v;
+    case Q_GT: return x > v;
+    default:   return x >= v;
+    }
+}
+
+/* Index of first a[i] == v, or -1 */
+int qscan_first(const int *a, int n, int v);
+
+/* Index of last a[i] == v, or -1 */
+int qscan_last(const int *a, int n, int v);
+
+/* Number of a[i] with (a[i] cmp v) */
+int qscan_count(const int *a, int n, q_cmp_t cmp, int v);
+
+/* Sum of a[0] .. a[n-1] */
+long long qscan_sum(const int *a, int n);
@@ -15,6 +15,7 @@
   OK as long as head field of queue_t structure is in first position in solution code
 */
 #include "queue.h"
+#include "pqueue.h"
 
 #include "report.h"
 #include "console.h"
@@ -24,12 +25,14 @@
 /*
   How large is a queue before it's considered big.
   This affects how it gets printed
-  and whether cautious mode is used when freeing the list
 */
 #define BIG_QUEUE 30
 
 int big_queue_size = BIG_QUEUE;
 
+/* Representation used for new queues (see q_backend_t) */
+int queue_backend = Q_LIST;
+
 /******* Global variables ******/
 
 /* Queue being tested */
@@ -37,6 +40,21 @@ queue_t *q = NULL;
 /* Number of elements in queue */
 size_t qcnt = 0;
 
+/*
+  Generator state for random insertions.  Kept apart from random(),
+  which the harness draws on for every allocation, so that the values
+  do not depend on the queue representation.
+*/
+unsigned int insert_seed = 1;
+
+/* Second queue, filled by split and drained by concat */
+queue_t *aux = NULL;
+size_t auxcnt = 0;
+
+/* Priority queue being tested, and number of keys in it */
+pqueue_t *pq = NULL;
+size_t pqcnt = 0;
+
 /* How many times can queue operations fail */
 int fail_limit = BIG_QUEUE;
 int fail_count = 0;
@@ -52,14 +70,60 @@ bool do_remove_head_quiet(int argc, char *argv[]);
 bool do_reverse(int argc, char *argv[]);
 bool do_size(int argc, char *argv[]);
 bool do_show(int argc, char *argv[]);
+bool do_insert_tail_many(int argc, char *argv[]);
+bool do_remove_head_many(int argc, char *argv[]);
+bool do_split(int argc, char *argv[]);
+bool do_concat(int argc, char *argv[]);
+bool do_swap(int argc, char *argv[]);
+bool do_insert_tail_random(int argc, char *argv[]);
+bool do_sort(int argc, char *argv[]);
+bool do_pq_new(int argc, char *argv[]);
+bool do_pq_free(int argc, char *argv[]);
+bool do_pq_insert(int argc, char *argv[]);
+bool do_pq_insert_random(int argc, char *argv[]);
+bool do_pq_remove(int argc, char *argv[]);
+bool do_pq_remove_many(int argc, char *argv[]);
+bool do_pq_decrease(int argc, char *argv[]);
+bool do_pq_bench(int argc, char *argv[]);
+bool do_bench(int argc, char *argv[]);
+bool do_find(int argc, char *argv[]);
+bool do_count(int argc, char *argv[]);
+bool do_sum(int argc, char *argv[]);
+bool do_fault(int argc, char *argv[]);
+
+/* Integer entry points, for compiled traces */
+static bool do_insert_head_int(int argc, int argv[]);
+static bool do_insert_tail_int(int argc, int argv[]);
+static bool do_remove_head_int(int argc, int argv[]);
+static bool do_size_int(int argc, int argv[]);
+static bool do_insert_tail_many_int(int argc, int argv[]);
+static bool do_remove_head_many_int(int argc, int argv[]);
+static bool insert_head(int val, int reps);
+static bool insert_tail(int val, int reps);
+static bool remove_head(bool check, int eval);
+static bool check_size(int reps);
+static bool insert_tail_many(int val, int n);
+static bool remove_head_many(int n, bool check, int eval);
 
 static void queue_init();
 
+/* Setting the seed restarts fault injection, so runs can be repeated */
+static void seed_changed(int oldval)
+{
+    fault_reset();
+}
+
+/* New limit takes effect at the next operation */
+static void timeout_changed(int oldval)
+{
+    watchdog_reset();
+}
+
 static void console_init() {
     add_cmd("new", do_new,
 	    "                | Create new queue");
     add_cmd("free", do_free,
-	    "                | Delete queue");
+	    "                | Delete queues and priority queue");
     add_cmd("ih", do_insert_head,
 	    " v [n]          | Insert v at head of queue n times (default: n == 1)");
     add_cmd("it", do_insert_tail,
@@ -74,8 +138,59 @@ static void console_init() {
 	    " [n]            | Compute queue size n times (default: n == 1)");
     add_cmd("show", do_show,
 	    "                | Show queue contents");
+    add_cmd("itm", do_insert_tail_many,
+	    " v n            | Insert v, v+1, ..., v+n-1 at tail of queue in one call");
+    add_cmd("rhm", do_remove_head_many,
+	    " n [v]          | Remove n from head in one call.  Optionally compare to v, v+1, ...");
+    add_cmd("split", do_split,
+	    " k              | Move elements k and beyond into the (empty) auxiliary queue");
+    add_cmd("concat", do_concat,
+	    "                | Move auxiliary queue onto tail of queue");
+    add_cmd("swap", do_swap,
+	    "                | Exchange queue with auxiliary queue");
+    add_cmd("itr", do_insert_tail_random,
+	    " n [m]          | Insert n random values in [0, m) at tail (default: m == 2^31)");
+    add_cmd("sort", do_sort,
+	    "                | Sort queue in ascending order");
+    add_cmd("pnew", do_pq_new,
+	    "                | Create new priority queue");
+    add_cmd("pfree", do_pq_free,
+	    "                | Delete priority queue");
+    add_cmd("pi", do_pq_insert,
+	    " k [n]          | Insert key k into priority queue n times (default: n == 1)");
+    add_cmd("pir", do_pq_insert_random,
+	    " n [m]          | Insert n random keys in [0, m) into priority queue");
+    add_cmd("pr", do_pq_remove,
+	    " [k]            | Remove smallest key.  Optionally compare to expected key k");
+    add_cmd("prm", do_pq_remove_many,
+	    " n              | Remove n smallest keys, checking they come out in order");
+    add_cmd("pdk", do_pq_decrease,
+	    " h k            | Decrease key of handle h to k");
+    add_cmd("find", do_find,
+	    " v [n]          | Find position of v in queue n times (default: n == 1)");
+    add_cmd("count", do_count,
+	    " op v [n]       | Count elements x with x op v (op: eq ne lt le gt ge) n times");
+    add_cmd("sum", do_sum,
+	    " [n]            | Sum queue elements n times (default: n == 1)");
+    add_cmd("bench", do_bench,
+	    " [max [file]]   | Time queue operations at sizes 1e3 .. max, optionally writing JSON to file");
+    add_cmd("pbench", do_pq_bench,
+	    " n              | Time n random inserts and pops against a sorted list");
+    add_int_cmd("ih", do_insert_head_int);
+    add_int_cmd("it", do_insert_tail_int);
+    add_int_cmd("rh", do_remove_head_int);
+    add_int_cmd("size", do_size_int);
+    add_int_cmd("itm", do_insert_tail_many_int);
+    add_int_cmd("rhm", do_remove_head_many_int);
+    add_cmd("fault", do_fault,
+	    " [[site] nth|every|percent N | load file | clear] | Show or set allocation failure rules");
     add_param("malloc", &fail_probability, "Malloc failure probability percent", NULL);
+    add_param("seed", &fail_seed, "Seed for allocation failures (setting it restarts them)",
+	      seed_changed);
+    add_param("timeout", &time_limit_us, "Time limit per operation, in microseconds (0 for none)",
+	      timeout_changed);
     add_param("fail", &fail_limit, "Number of times allow queue operations to return false", NULL);
+    add_param("backend", &queue_backend, "Queue representation for new (0 = list, 1 = chunked, 2 = ring)", NULL);
 }
 
 bool do_new(int argc, char *argv[])
@@ -86,8 +201,12 @@ bool do_new(int argc, char *argv[])
 	ok = do_free(argc, argv);
     }
     error_check();
+    if (queue_backend < 0 || queue_backend >= Q_NUM_BACKENDS) {
+	report(1, "Invalid queue backend %d", queue_backend);
+	return false;
+    }
     if (exception_setup(true))
-	q = q_new();
+	q = q_new_backend(queue_backend);
     exception_cancel();
     qcnt = 0;
     show_queue(3);
@@ -100,14 +219,18 @@ bool do_free(int argc, char *argv[])
     if (q == NULL)
 	report(3, "Warning: Calling free on null queue");
     error_check();
-    if (qcnt > big_queue_size)
-	set_cautious_mode(false);
-    if (exception_setup(true))
+    if (exception_setup(true)) {
 	q_free(q);
+	q_free(aux);
+	pq_free(pq);
+    }
     exception_cancel();
-    set_cautious_mode(true);
     q = NULL;
     qcnt = 0;
+    aux = NULL;
+    auxcnt = 0;
+    pq = NULL;
+    pqcnt = 0;
     show_queue(3);
     size_t bcnt = allocation_check();
     if (bcnt > 0) {
@@ -121,8 +244,6 @@ bool do_insert_head(int argc, char *argv[])
 {
     int val;
     int reps = 1;
-    int r;
-    bool ok = true;
     if (argc != 2 && argc != 3) {
 	report(1, "%s needs 1-2 arguments", argv[0]);
 	return false;
@@ -137,6 +258,23 @@ bool do_insert_head(int argc, char *argv[])
 	    return false;
 	}
     }
+    return insert_head(val, reps);
+}
+
+static bool do_insert_head_int(int argc, int argv[])
+{
+    if (argc != 1 && argc != 2) {
+	report(1, "ih needs 1-2 arguments");
+	return false;
+    }
+    return insert_head(argv[0], argc == 2 ? argv[1] : 1);
+}
+
+/* Insert val at head reps times */
+static bool insert_head(int val, int reps)
+{
+    int r;
+    bool ok = true;
     if (q == NULL)
 	report(3, "Warning: Calling insert head on null queue");
     error_check();
@@ -166,8 +304,6 @@ bool do_insert_tail(int argc, char *argv[])
 {
     int val;
     int reps = 1;
-    int r;
-    bool ok = true;
     if (argc != 2 && argc != 3) {
 	report(1, "%s needs 1-2 arguments", argv[0]);
 	return false;
@@ -182,6 +318,23 @@ bool do_insert_tail(int argc, char *argv[])
 	    return false;
 	}
     }
+    return insert_tail(val, reps);
+}
+
+static bool do_insert_tail_int(int argc, int argv[])
+{
+    if (argc != 1 && argc != 2) {
+	report(1, "it needs 1-2 arguments");
+	return false;
+    }
+    return insert_tail(argv[0], argc == 2 ? argv[1] : 1);
+}
+
+/* Insert val at tail reps times */
+static bool insert_tail(int val, int reps)
+{
+    int r;
+    bool ok = true;
     if (q == NULL)
 	report(3, "Warning: Calling insert tail on null queue");
     error_check();
@@ -209,19 +362,31 @@ bool do_insert_tail(int argc, char *argv[])
 
 bool do_remove_head(int argc, char *argv[])
 {
-    int val, ival, eval;
+    int eval = 0;
     bool check = argc > 1;
-    bool ok = true;
-    val = ival = random();
     if (check) {
 	if (!get_int(argv[1], &eval)) {
 	    report(1, "Invalid comparison value '%s'", argv[1]);
 	    return false;
 	}
     }
+    return remove_head(check, eval);
+}
+
+static bool do_remove_head_int(int argc, int argv[])
+{
+    return remove_head(argc > 0, argc > 0 ? argv[0] : 0);
+}
+
+/* Remove head, and if check is set, compare it with eval */
+static bool remove_head(bool check, int eval)
+{
+    int val, ival;
+    bool ok = true;
+    val = ival = random();
     if (q == NULL)
 	report(3, "Warning: Calling remove head on null queue");
-    else if (q->head == NULL)
+    else if (qcnt == 0)
 	report(3, "Warning: Calling remove head on empty queue");
     error_check();
     bool rval = false;
@@ -258,7 +423,7 @@ bool do_remove_head_quiet(int argc, char *argv[])
     bool ok = true;
     if (q == NULL)
 	report(3, "Warning: Calling remove head on null queue");
-    else if (q->head == NULL)
+    else if (qcnt == 0)
 	report(3, "Warning: Calling remove head on empty queue");
     error_check();
     bool rval = false;
@@ -297,8 +462,6 @@ bool do_size(int argc, char *argv[])
 {
 
     int reps = 1;
-    int r;
-    bool ok = true;
     if (argc != 1 && argc != 2) {
 	report(1, "%s needs 0-1 arguments", argv[0]);
 	return false;
@@ -308,6 +471,23 @@ bool do_size(int argc, char *argv[])
 	    report(1, "Invalid number of calls to size '%s'", argv[2]);
 	}
     }
+    return check_size(reps);
+}
+
+static bool do_size_int(int argc, int argv[])
+{
+    if (argc > 1) {
+	report(1, "size needs 0-1 arguments");
+	return false;
+    }
+    return check_size(argc == 1 ? argv[0] : 1);
+}
+
+/* Call q_size reps times and compare with expected count */
+static bool check_size(int reps)
+{
+    int r;
+    bool ok = true;
     int cnt = 0;
     if (q == NULL)
 	report(3, "Warning: Calling size on null queue");
@@ -333,132 +513,1131 @@ bool do_size(int argc, char *argv[])
     return ok && !error_check();
 }
 
-static bool show_queue(int vlevel)
+bool do_insert_tail_many(int argc, char *argv[])
 {
-    bool ok = true;
-    if (verblevel < vlevel)
-	return true;
-    int cnt = 0;
-    if (q == NULL) {
-	report(vlevel, "q = NULL");
-	return true;
-    }
-    report_noreturn(vlevel, "q = [");
-    list_ele_t *e = q->head;
-    if (exception_setup(true)) {
-	while (ok && e && cnt < qcnt) {
-	    if (cnt < big_queue_size)
-		report_noreturn(vlevel, cnt == 0 ? "%d" : " %d", e->value);
-	    e = e->next;
-	    cnt++;
-	    ok = ok && !error_check();
-	}
+    int val, n;
+    if (argc != 3) {
+	report(1, "%s needs 2 arguments", argv[0]);
+	return false;
     }
-    exception_cancel();
-    if (!ok) {
-	report(vlevel, " ... ]");
+    if (!get_int(argv[1], &val)) {
+	report(1, "Invalid insertion value '%s'", argv[1]);
 	return false;
     }
-    if (e == NULL) {
-	if (cnt <= big_queue_size)
-	    report(vlevel, "]");
-	else
-	    report(vlevel, " ... ]");
-    } else {
-	report(vlevel, " ... ]");
-	report(vlevel, "ERROR:  Either list has cycle, or queue has more than %d elements",
-	       qcnt);
-	ok = false;
+    if (!get_int(argv[2], &n) || n < 0) {
+	report(1, "Invalid number of insertions '%s'", argv[2]);
+	return false;
     }
-    return ok;
+    return insert_tail_many(val, n);
 }
 
-bool do_show(int argc, char *argv[])
+static bool do_insert_tail_many_int(int argc, int argv[])
 {
-    return show_queue(0);
+    if (argc != 2) {
+	report(1, "itm needs 2 arguments");
+	return false;
+    }
+    if (argv[1] < 0) {
+	report(1, "Invalid number of insertions %d", argv[1]);
+	return false;
+    }
+    return insert_tail_many(argv[0], argv[1]);
 }
 
-/* Signal handlers */
-void sigsegvhandler(int sig) {
-    trigger_exception("Segmentation fault occurred.  You dereferenced a NULL or invalid pointer");
+/* Insert n consecutive values starting at val with one call */
+static bool insert_tail_many(int val, int n)
+{
+    int i;
+    bool ok = true;
+    int *vals = malloc((n ? n : 1) * sizeof(int));
+    if (!vals) {
+	report(1, "Could not allocate %d values", n);
+	return false;
+    }
+    for (i = 0; i < n; i++)
+	vals[i] = val + i;
+    if (q == NULL)
+	report(3, "Warning: Calling insert tail on null queue");
+    error_check();
+    int cnt = 0;
+    if (exception_setup(true))
+	cnt = q_insert_tail_many(q, vals, n);
+    exception_cancel();
+    free(vals);
+    if (cnt < 0 || cnt > n) {
+	report(1, "ERROR: Inserted %d of %d values", cnt, n);
+	ok = false;
+    } else {
+	qcnt += cnt;
+	if (cnt < n) {
+	    fail_count++;
+	    if (fail_count < fail_limit)
+		report(2, "Inserted only %d of %d values", cnt, n);
+	    else {
+		report(1, "ERROR: Inserted only %d of %d values (%d failures total)",
+		       cnt, n, fail_count);
+		ok = false;
+	    }
+	}
+    }
+    show_queue(3);
+    return ok && !error_check();
 }
 
-void sigalrmhandler(int sig) {
-    trigger_exception("Time limit exceeded.  Either you are in an infinite loop, or your code is too inefficient");
+bool do_remove_head_many(int argc, char *argv[])
+{
+    int n, eval = 0;
+    bool check = argc > 2;
+    if (argc != 2 && argc != 3) {
+	report(1, "%s needs 1-2 arguments", argv[0]);
+	return false;
+    }
+    if (!get_int(argv[1], &n) || n < 0) {
+	report(1, "Invalid number of removals '%s'", argv[1]);
+	return false;
+    }
+    if (check && !get_int(argv[2], &eval)) {
+	report(1, "Invalid comparison value '%s'", argv[2]);
+	return false;
+    }
+    return remove_head_many(n, check, eval);
 }
 
-
-static void queue_init() {
-    fail_count = 0;
-    q = NULL;
-    signal(SIGSEGV, sigsegvhandler);
-    signal(SIGALRM, sigalrmhandler);
+static bool do_remove_head_many_int(int argc, int argv[])
+{
+    if (argc != 1 && argc != 2) {
+	report(1, "rhm needs 1-2 arguments");
+	return false;
+    }
+    if (argv[0] < 0) {
+	report(1, "Invalid number of removals %d", argv[0]);
+	return false;
+    }
+    return remove_head_many(argv[0], argc == 2, argc == 2 ? argv[1] : 0);
 }
 
-
-static bool queue_quit(int argc, char *argv[]) {
-    report(3, "Freeing queue");
-    if (qcnt > big_queue_size)
-	set_cautious_mode(false);
+/* Remove n values with one call, checking them against eval, eval+1, ... */
+static bool remove_head_many(int n, bool check, int eval)
+{
+    int i;
+    bool ok = true;
+    int *vals = malloc((n ? n : 1) * sizeof(int));
+    if (!vals) {
+	report(1, "Could not allocate %d values", n);
+	return false;
+    }
+    if (q == NULL)
+	report(3, "Warning: Calling remove head on null queue");
+    error_check();
+    int cnt = 0;
     if (exception_setup(true))
-	q_free(q);
+	cnt = q_remove_head_many(q, vals, n);
     exception_cancel();
-    set_cautious_mode(true);
-    size_t bcnt = allocation_check();
-    if (bcnt > 0) {
-	report(1, "ERROR: Freed queue, but %lu blocks are still allocated", bcnt);
-	return false;
+    int expect = n < (int) qcnt ? n : (int) qcnt;
+    if (cnt != expect) {
+	report(1, "ERROR:  Removed %d values, but expected %d", cnt, expect);
+	ok = false;
+    } else {
+	report(2, "Removed %d values from queue", cnt);
     }
-    return true;
+    if (cnt > 0 && cnt <= (int) qcnt)
+	qcnt -= cnt;
+    for (i = 0; ok && check && i < cnt; i++) {
+	if (vals[i] != eval + i) {
+	    report(1, "ERROR:  Removed value %d != expected value %d at position %d",
+		   vals[i], eval + i, i);
+	    ok = false;
+	}
+    }
+    free(vals);
+    show_queue(3);
+    return ok && !error_check();
 }
 
-
-static void usage(char *cmd) {
-    printf("Usage: %s [-h] [-f IFILE][-v VLEVEL][-l LFILE]\n",  cmd);
-    printf("\t-h         Print this information\n");
-    printf("\t-f IFILE   Read commands from IFILE\n");
-    printf("\t-v VLEVEL  Set verbosity level\n");
-    printf("\t-l LFILE   Echo results to LFILE\n");
-    exit(0);
+bool do_split(int argc, char *argv[])
+{
+    int k;
+    if (argc != 2) {
+	report(1, "%s needs 1 argument", argv[0]);
+	return false;
+    }
+    if (!get_int(argv[1], &k)) {
+	report(1, "Invalid split position '%s'", argv[1]);
+	return false;
+    }
+    if (q == NULL) {
+	report(3, "Warning: Calling split on null queue");
+	return true;
+    }
+    if (auxcnt > 0) {
+	report(1, "Auxiliary queue holds %d elements.  Use concat first",
+	       (int) auxcnt);
+	return false;
+    }
+    error_check();
+    bool rval = false;
+    if (exception_setup(true)) {
+	if (aux == NULL)
+	    aux = q_new_backend(q->backend);
+	rval = aux && q_split(q, k, aux);
+    }
+    exception_cancel();
+    bool ok = true;
+    if (rval) {
+	if (k < 0 || k > qcnt) {
+	    report(1, "ERROR:  Split at %d of %d elements succeeded", k, (int) qcnt);
+	    ok = false;
+	} else {
+	    auxcnt = qcnt - k;
+	    qcnt = k;
+	    report(2, "Moved %d elements to auxiliary queue", (int) auxcnt);
+	}
+    } else if (k >= 0 && k <= qcnt) {
+	fail_count++;
+	if (fail_count < fail_limit)
+	    report(2, "Split failed");
+	else {
+	    report(1, "ERROR: Split failed (%d failures total)", fail_count);
+	    ok = false;
+	}
+    } else {
+	report(2, "Split at %d rejected", k);
+    }
+    show_queue(3);
+    return ok && !error_check();
 }
 
-#define BUFSIZE 256
-
-int main(int argc, char *argv[]) {
-    /* To hold input file name */
-    char buf[BUFSIZE];
-    char *infile_name = NULL;
-    char lbuf[BUFSIZE];
-    char *logfile_name = NULL;
-    int level = 4;
-    int c;
-
-    while ((c = getopt(argc, argv, "hv:f:l:")) != -1) {
-	switch(c) {
-	case 'h':
-	    usage(argv[0]);
-	    break;
-	case 'f':
-	    infile_name = strncpy(buf, optarg, BUFSIZE-1);
-	    buf[BUFSIZE-1] = '\0';
-	    break;
-	case 'v':
-	    level = atoi(optarg);
-	    break;
-	case 'l':
-	    logfile_name = strncpy(lbuf, optarg, BUFSIZE-1);
-	    lbuf[BUFSIZE-1] = '\0';
-	    break;
-	default:
-	    printf("Unknown option '%c'\n", c);
-	    usage(argv[0]);
-	    break;
+bool do_concat(int argc, char *argv[])
+{
+    if (q == NULL) {
+	report(3, "Warning: Calling concat on null queue");
+	return true;
+    }
+    if (aux == NULL) {
+	report(3, "Warning: No auxiliary queue to concatenate");
+	return true;
+    }
+    error_check();
+    bool rval = false;
+    if (exception_setup(true))
+	rval = q_concat(q, aux);
+    exception_cancel();
+    bool ok = true;
+    if (rval) {
+	qcnt += auxcnt;
+	auxcnt = 0;
+    } else {
+	/* Circular arrays may need space to copy into */
+	fail_count++;
+	if (fail_count < fail_limit)
+	    report(2, "Concatenation failed");
+	else {
+	    report(1, "ERROR: Concatenation failed (%d failures total)", fail_count);
+	    ok = false;
 	}
     }
-    queue_init();
-    init_cmd();
-    console_init();
-    set_verblevel(level);
+    show_queue(3);
+    return ok && !error_check();
+}
+
+bool do_swap(int argc, char *argv[])
+{
+    queue_t *t = q;
+    q = aux;
+    aux = t;
+    size_t c = qcnt;
+    qcnt = auxcnt;
+    auxcnt = c;
+    show_queue(3);
+    return true;
+}
+
+bool do_insert_tail_random(int argc, char *argv[])
+{
+    int n, m = 0, r;
+    bool ok = true;
+    if (argc != 2 && argc != 3) {
+	report(1, "%s needs 1-2 arguments", argv[0]);
+	return false;
+    }
+    if (!get_int(argv[1], &n) || n < 0) {
+	report(1, "Invalid number of insertions '%s'", argv[1]);
+	return false;
+    }
+    if (argc == 3 && (!get_int(argv[2], &m) || m <= 0)) {
+	report(1, "Invalid value range '%s'", argv[2]);
+	return false;
+    }
+    if (q == NULL)
+	report(3, "Warning: Calling insert tail on null queue");
+    error_check();
+    if (exception_setup(true)) {
+	for (r = 0; ok && r < n; r++) {
+	    int val = m ? rand_r(&insert_seed) % m : rand_r(&insert_seed);
+	    if (q_insert_tail(q, val)) {
+		qcnt++;
+	    } else {
+		fail_count++;
+		if (fail_count < fail_limit)
+		    report(2, "Insertion of %d failed", val);
+		else {
+		    report(1, "ERROR: Insertion of %d failed (%d failures total)", val, fail_count);
+		    ok = false;
+		}
+	    }
+	    ok = ok && !error_check();
+	}
+    }
+    exception_cancel();
+    show_queue(3);
+    return ok;
+}
+
+bool do_sort(int argc, char *argv[])
+{
+    bool ok = true;
+    if (q == NULL)
+	report(3, "Warning: Calling sort on null queue");
+    error_check();
+    bool rval = false;
+    if (exception_setup(true))
+	rval = q_sort(q);
+    exception_cancel();
+    if (!rval) {
+	if (q != NULL) {
+	    fail_count++;
+	    if (fail_count < fail_limit)
+		report(2, "Sort failed");
+	    else {
+		report(1, "ERROR: Sort failed (%d failures total)", fail_count);
+		ok = false;
+	    }
+	}
+	show_queue(3);
+	return ok && !error_check();
+    }
+
+    /* Check order, count, and that the tail is really the last element */
+    q_iter_t it;
+    int cnt = 0, val, prev = 0;
+    if (exception_setup(true)) {
+	q_iter_init(q, &it);
+	while (ok && cnt <= qcnt && q_iter_next(&it, &val)) {
+	    if (cnt > 0 && val < prev) {
+		report(1, "ERROR:  Value %d at position %d follows larger value %d",
+		       val, cnt, prev);
+		ok = false;
+	    }
+	    prev = val;
+	    cnt++;
+	}
+	if (ok && cnt != qcnt) {
+	    report(1, "ERROR:  Sorted queue has %d elements, but should have %d",
+		   cnt, (int) qcnt);
+	    ok = false;
+	}
+	if (ok && q->backend == Q_LIST && qcnt > 0
+	    && (q->tail->next != NULL || q->tail->value != prev)) {
+	    report(1, "ERROR:  Tail does not point to last element after sort");
+	    ok = false;
+	}
+    }
+    exception_cancel();
+    show_queue(3);
+    return ok && !error_check();
+}
+
+bool do_fault(int argc, char *argv[])
+{
+    bool ok = true;
+    if (argc == 1) {
+	fault_show();
+	return true;
+    }
+    if (argc == 2 && strcmp(argv[1], "clear") == 0)
+	fault_clear();
+    else if (argc == 3 && strcmp(argv[1], "load") == 0)
+	ok = fault_load(argv[2]);
+    else if (argc == 3 || argc == 4) {
+	ok = fault_add_rule(argc == 4 ? argv[1] : NULL, argv[argc - 2],
+			    argv[argc - 1]);
+	if (!ok)
+	    report(1, "Invalid fault rule");
+    } else {
+	report(1, "%s needs 0-3 arguments", argv[0]);
+	ok = false;
+    }
+    return ok;
+}
+
+/* Parse optional repetition count in argv[i] */
+static bool get_reps(int argc, char *argv[], int i, int *reps)
+{
+    *reps = 1;
+    if (argc > i && (!get_int(argv[i], reps) || *reps < 1)) {
+	report(1, "Invalid number of calls '%s'", argv[i]);
+	return false;
+    }
+    return true;
+}
+
+bool do_find(int argc, char *argv[])
+{
+    int v, reps, r;
+    if (argc != 2 && argc != 3) {
+	report(1, "%s needs 1-2 arguments", argv[0]);
+	return false;
+    }
+    if (!get_int(argv[1], &v)) {
+	report(1, "Invalid search value '%s'", argv[1]);
+	return false;
+    }
+    if (!get_reps(argc, argv, 2, &reps))
+	return false;
+    if (q == NULL)
+	report(3, "Warning: Calling find on null queue");
+    error_check();
+    int pos = -1;
+    if (exception_setup(true)) {
+	for (r = 0; r < reps; r++)
+	    pos = q_find(q, v);
+    }
+    exception_cancel();
+    /* Check against a walk with the iterator */
+    q_iter_t it;
+    int x, i = 0, epos = -1;
+    q_iter_init(q, &it);
+    while (epos < 0 && q_iter_next(&it, &x)) {
+	if (x == v)
+	    epos = i;
+	i++;
+    }
+    if (pos != epos) {
+	report(1, "ERROR:  Found %d at position %d, but correct position is %d",
+	       v, pos, epos);
+	return false;
+    }
+    report(2, "Position of %d = %d", v, pos);
+    return !error_check();
+}
+
+bool do_count(int argc, char *argv[])
+{
+    static char *ops[] = {"eq", "ne", "lt", "le", "gt", "ge"};
+    int v, reps, r;
+    q_cmp_t cmp;
+    if (argc != 3 && argc != 4) {
+	report(1, "%s needs 2-3 arguments", argv[0]);
+	return false;
+    }
+    for (cmp = Q_EQ; cmp <= Q_GE; cmp++)
+	if (strcmp(argv[1], ops[cmp]) == 0)
+	    break;
+    if (cmp > Q_GE) {
+	report(1, "Invalid comparison '%s'", argv[1]);
+	return false;
+    }
+    if (!get_int(argv[2], &v)) {
+	report(1, "Invalid comparison value '%s'", argv[2]);
+	return false;
+    }
+    if (!get_reps(argc, argv, 3, &reps))
+	return false;
+    if (q == NULL)
+	report(3, "Warning: Calling count on null queue");
+    error_check();
+    int cnt = 0;
+    if (exception_setup(true)) {
+	for (r = 0; r < reps; r++)
+	    cnt = q_count_if(q, cmp, v);
+    }
+    exception_cancel();
+    q_iter_t it;
+    int x, ecnt = 0;
+    q_iter_init(q, &it);
+    while (q_iter_next(&it, &x)) {
+	switch (cmp) {
+	case Q_EQ: ecnt += x == v; break;
+	case Q_NE: ecnt += x != v; break;
+	case Q_LT: ecnt += x < v; break;
+	case Q_LE: ecnt += x <= v; break;
+	case Q_GT: ecnt += x > v; break;
+	case Q_GE: ecnt += x >= v; break;
+	}
+    }
+    if (cnt != ecnt) {
+	report(1, "ERROR:  Counted %d elements %s %d, but correct count is %d",
+	       cnt, argv[1], v, ecnt);
+	return false;
+    }
+    report(2, "Elements %s %d = %d", argv[1], v, cnt);
+    return !error_check();
+}
+
+bool do_sum(int argc, char *argv[])
+{
+    int reps, r;
+    if (argc != 1 && argc != 2) {
+	report(1, "%s needs 0-1 arguments", argv[0]);
+	return false;
+    }
+    if (!get_reps(argc, argv, 1, &reps))
+	return false;
+    if (q == NULL)
+	report(3, "Warning: Calling sum on null queue");
+    error_check();
+    long long sum = 0;
+    if (exception_setup(true)) {
+	for (r = 0; r < reps; r++)
+	    sum = q_sum(q);
+    }
+    exception_cancel();
+    q_iter_t it;
+    int x;
+    long long esum = 0;
+    q_iter_init(q, &it);
+    while (q_iter_next(&it, &x))
+	esum += x;
+    if (sum != esum) {
+	report(1, "ERROR:  Computed sum as %lld, but correct value is %lld", sum, esum);
+	return false;
+    }
+    report(2, "Sum = %lld", sum);
+    return !error_check();
+}
+
+/*
+  Benchmark mode.  Each queue operation is timed over a whole queue of
+  n elements and reported per element.  Insertions are timed twice:
+  cold, on a new queue whose storage all comes from malloc, and warm,
+  after the queue has been emptied so that it can reuse its own storage.
+  The difference is the cost of the allocator.
+*/
+
+typedef enum {
+    B_IH, B_IT, B_ITM, B_RH, B_RHM, B_SIZE, B_REVERSE, B_SORT, B_FREE, B_NUM
+} bench_op_t;
+
+static const char *bench_name[B_NUM] = {
+    "ih", "it", "itm", "rh", "rhm", "size", "reverse", "sort", "free"
+};
+
+/* Seconds for each operation, summed over repetitions */
+typedef struct {
+    double cold[B_NUM];
+    double warm[B_NUM];
+} bench_times_t;
+
+/* Time one round of every operation at size n.  Return false if out of memory */
+static bool bench_round(int n, int *vals, bench_times_t *t)
+{
+    double timer;
+    int i;
+    bool ok = true;
+
+    queue_t *bq = q_new_backend(queue_backend);
+    if (!bq)
+	return false;
+    init_time(&timer);
+    for (i = 0; ok && i < n; i++)
+	ok = q_insert_head(bq, vals[i]);
+    t->cold[B_IH] += delta_time(&timer);
+    for (i = 0; ok && i < n; i++)
+	q_remove_head(bq, NULL);
+    t->cold[B_RH] += delta_time(&timer);
+    for (i = 0; ok && i < n; i++)
+	ok = q_insert_head(bq, vals[i]);
+    t->warm[B_IH] += delta_time(&timer);
+    for (i = 0; ok && i < n; i++)
+	q_size(bq);
+    t->cold[B_SIZE] += delta_time(&timer);
+    q_reverse(bq);
+    t->cold[B_REVERSE] += delta_time(&timer);
+    ok = ok && q_sort(bq);
+    t->cold[B_SORT] += delta_time(&timer);
+    q_free(bq);
+    t->cold[B_FREE] += delta_time(&timer);
+
+    bq = q_new_backend(queue_backend);
+    if (!bq)
+	return false;
+    init_time(&timer);
+    for (i = 0; ok && i < n; i++)
+	ok = q_insert_tail(bq, vals[i]);
+    t->cold[B_IT] += delta_time(&timer);
+    q_remove_head_many(bq, NULL, n);
+    t->cold[B_RHM] += delta_time(&timer);
+    for (i = 0; ok && i < n; i++)
+	ok = q_insert_tail(bq, vals[i]);
+    t->warm[B_IT] += delta_time(&timer);
+    q_remove_head_many(bq, NULL, n);
+    init_time(&timer);
+    ok = ok && q_insert_tail_many(bq, vals, n) == n;
+    t->warm[B_ITM] += delta_time(&timer);
+    q_free(bq);
+
+    bq = q_new_backend(queue_backend);
+    if (!bq)
+	return false;
+    init_time(&timer);
+    ok = ok && q_insert_tail_many(bq, vals, n) == n;
+    t->cold[B_ITM] += delta_time(&timer);
+    q_free(bq);
+    return ok;
+}
+
+bool do_bench(int argc, char *argv[])
+{
+    int max = 1000000;
+    char *fname = NULL;
+    if (argc > 3 || (argc > 1 && (!get_int(argv[1], &max) || max < 1000))) {
+	report(1, "%s takes a maximum size of at least 1000 and a file name", argv[0]);
+	return false;
+    }
+    if (argc == 3)
+	fname = argv[2];
+    FILE *json = NULL;
+    if (fname && !(json = fopen(fname, "w"))) {
+	report(1, "Could not open '%s' for writing", fname);
+	return false;
+    }
+    if (json)
+	fprintf(json, "{\"backend\": %d, \"results\": [", queue_backend);
+
+    /* Benchmark against a reliable allocator */
+    fault_suspend();
+    bool ok = true;
+    bool first = true;
+    long n;
+    report(1, "%10s %8s %10s %10s %10s", "size", "op", "ns/op", "warm ns", "alloc ns");
+    for (n = 1000; ok && n <= max; n *= 10) {
+	int *vals = malloc(n * sizeof(int));
+	if (!vals) {
+	    report(1, "Could not allocate %ld values", n);
+	    break;
+	}
+	unsigned int seed = 1;
+	int i;
+	for (i = 0; i < n; i++)
+	    vals[i] = rand_r(&seed);
+	/* Repeat small sizes so each operation is timed over 1e6 elements */
+	int reps = n < 1000000 ? 1000000 / n : 1;
+	bench_times_t t = {{0}};
+	int r;
+	error_check();
+	if (exception_setup(false)) {
+	    for (r = 0; ok && r < reps; r++)
+		ok = bench_round(n, vals, &t);
+	}
+	exception_cancel();
+	free(vals);
+	if (!ok || error_check()) {
+	    report(1, "Stopped at size %ld: could not allocate queue", n);
+	    ok = false;
+	    break;
+	}
+	bench_op_t op;
+	for (op = 0; op < B_NUM; op++) {
+	    double scale = 1e9 / ((double) n * reps);
+	    double cold = t.cold[op] * scale;
+	    if (t.warm[op] > 0) {
+		double warm = t.warm[op] * scale;
+		report(1, "%10ld %8s %10.2f %10.2f %10.2f", n, bench_name[op],
+		       cold, warm, cold - warm);
+		if (json)
+		    fprintf(json, "%s\n  {\"size\": %ld, \"op\": \"%s\", \"ns\": %.3f, "
+			    "\"warm_ns\": %.3f, \"alloc_ns\": %.3f}",
+			    first ? "" : ",", n, bench_name[op], cold, warm, cold - warm);
+	    } else {
+		report(1, "%10ld %8s %10.2f", n, bench_name[op], cold);
+		if (json)
+		    fprintf(json, "%s\n  {\"size\": %ld, \"op\": \"%s\", \"ns\": %.3f}",
+			    first ? "" : ",", n, bench_name[op], cold);
+	    }
+	    first = false;
+	}
+    }
+    fault_resume();
+    if (json) {
+	fprintf(json, "\n]}\n");
+	fclose(json);
+    }
+    /* A size that ran out of memory still ends the benchmark normally */
+    return !error_check();
+}
+
+/* Report state of priority queue */
+static void show_pq(int vlevel)
+{
+    int key;
+    if (pq == NULL)
+	report(vlevel, "pq = NULL");
+    else if (pq_peek(pq, &key))
+	report(vlevel, "pq: %d keys, smallest %d", pq_size(pq), key);
+    else
+	report(vlevel, "pq: empty");
+}
+
+bool do_pq_new(int argc, char *argv[])
+{
+    bool ok = true;
+    if (pq != NULL) {
+	report(3, "Freeing old priority queue");
+	ok = do_pq_free(argc, argv);
+    }
+    error_check();
+    if (exception_setup(true))
+	pq = pq_new();
+    exception_cancel();
+    pqcnt = 0;
+    show_pq(3);
+    return ok && !error_check();
+}
+
+bool do_pq_free(int argc, char *argv[])
+{
+    bool ok = true;
+    if (pq == NULL)
+	report(3, "Warning: Calling free on null priority queue");
+    error_check();
+    if (exception_setup(true))
+	pq_free(pq);
+    exception_cancel();
+    pq = NULL;
+    pqcnt = 0;
+    show_pq(3);
+    /* Only a full check when nothing else holds blocks */
+    size_t bcnt = allocation_check();
+    if (q == NULL && aux == NULL && bcnt > 0) {
+	report(1, "ERROR: Freed priority queue, but %lu blocks are still allocated", bcnt);
+	ok = false;
+    }
+    return ok && !error_check();
+}
+
+/* Insert key, handling failure like the queue insertions */
+static bool pq_insert_checked(int key, bool *ok)
+{
+    pq_handle_t h = -1;
+    if (pq_insert(pq, key, &h)) {
+	pqcnt++;
+	report(3, "Inserted %d with handle %d", key, h);
+	return true;
+    }
+    fail_count++;
+    if (fail_count < fail_limit)
+	report(2, "Insertion of %d failed", key);
+    else {
+	report(1, "ERROR: Insertion of %d failed (%d failures total)", key, fail_count);
+	*ok = false;
+    }
+    return false;
+}
+
+bool do_pq_insert(int argc, char *argv[])
+{
+    int key, reps = 1, r;
+    bool ok = true;
+    if (argc != 2 && argc != 3) {
+	report(1, "%s needs 1-2 arguments", argv[0]);
+	return false;
+    }
+    if (!get_int(argv[1], &key)) {
+	report(1, "Invalid key '%s'", argv[1]);
+	return false;
+    }
+    if (argc == 3 && !get_int(argv[2], &reps)) {
+	report(1, "Invalid number of insertions '%s'", argv[2]);
+	return false;
+    }
+    if (pq == NULL)
+	report(3, "Warning: Calling insert on null priority queue");
+    error_check();
+    if (exception_setup(true)) {
+	for (r = 0; ok && r < reps; r++) {
+	    pq_insert_checked(key, &ok);
+	    ok = ok && !error_check();
+	}
+    }
+    exception_cancel();
+    show_pq(3);
+    return ok;
+}
+
+bool do_pq_insert_random(int argc, char *argv[])
+{
+    int n, m = 0, r;
+    bool ok = true;
+    if (argc != 2 && argc != 3) {
+	report(1, "%s needs 1-2 arguments", argv[0]);
+	return false;
+    }
+    if (!get_int(argv[1], &n) || n < 0) {
+	report(1, "Invalid number of insertions '%s'", argv[1]);
+	return false;
+    }
+    if (argc == 3 && (!get_int(argv[2], &m) || m <= 0)) {
+	report(1, "Invalid key range '%s'", argv[2]);
+	return false;
+    }
+    if (pq == NULL)
+	report(3, "Warning: Calling insert on null priority queue");
+    error_check();
+    if (exception_setup(true)) {
+	for (r = 0; ok && r < n; r++) {
+	    pq_insert_checked(m ? rand_r(&insert_seed) % m : rand_r(&insert_seed), &ok);
+	    ok = ok && !error_check();
+	}
+    }
+    exception_cancel();
+    show_pq(3);
+    return ok;
+}
+
+bool do_pq_remove(int argc, char *argv[])
+{
+    int key, ekey;
+    bool check = argc > 1;
+    bool ok = true;
+    if (check && !get_int(argv[1], &ekey)) {
+	report(1, "Invalid comparison key '%s'", argv[1]);
+	return false;
+    }
+    if (pq == NULL)
+	report(3, "Warning: Calling remove on null priority queue");
+    else if (pqcnt == 0)
+	report(3, "Warning: Calling remove on empty priority queue");
+    error_check();
+    bool rval = false;
+    if (exception_setup(true))
+	rval = pq_pop_min(pq, &key);
+    exception_cancel();
+    if (rval) {
+	report(2, "Removed %d from priority queue", key);
+	pqcnt--;
+	if (check && key != ekey) {
+	    report(1, "ERROR:  Removed key %d != expected key %d", key, ekey);
+	    ok = false;
+	}
+    } else {
+	fail_count++;
+	if (!check && fail_count < fail_limit)
+	    report(2, "Removal from priority queue failed");
+	else {
+	    report(1, "ERROR:  Removal from priority queue failed (%d failures total)",
+		   fail_count);
+	    ok = false;
+	}
+    }
+    show_pq(3);
+    return ok && !error_check();
+}
+
+bool do_pq_remove_many(int argc, char *argv[])
+{
+    int n, r, key, prev = 0;
+    bool ok = true;
+    if (argc != 2) {
+	report(1, "%s needs 1 argument", argv[0]);
+	return false;
+    }
+    if (!get_int(argv[1], &n) || n < 0 || n > pqcnt) {
+	report(1, "Invalid number of removals '%s'", argv[1]);
+	return false;
+    }
+    error_check();
+    if (exception_setup(true)) {
+	for (r = 0; ok && r < n; r++) {
+	    if (!pq_pop_min(pq, &key)) {
+		report(1, "ERROR:  Removal %d of %d failed", r + 1, n);
+		ok = false;
+	    } else {
+		pqcnt--;
+		if (r > 0 && key < prev) {
+		    report(1, "ERROR:  Removed key %d after larger key %d", key, prev);
+		    ok = false;
+		}
+		prev = key;
+	    }
+	    ok = ok && !error_check();
+	}
+    }
+    exception_cancel();
+    if (ok && pq_size(pq) != pqcnt) {
+	report(1, "ERROR:  Priority queue size is %d, but should be %d",
+	       pq_size(pq), (int) pqcnt);
+	ok = false;
+    }
+    show_pq(3);
+    return ok;
+}
+
+bool do_pq_decrease(int argc, char *argv[])
+{
+    int h, key;
+    if (argc != 3) {
+	report(1, "%s needs 2 arguments", argv[0]);
+	return false;
+    }
+    if (!get_int(argv[1], &h)) {
+	report(1, "Invalid handle '%s'", argv[1]);
+	return false;
+    }
+    if (!get_int(argv[2], &key)) {
+	report(1, "Invalid key '%s'", argv[2]);
+	return false;
+    }
+    if (pq == NULL)
+	report(3, "Warning: Calling decrease key on null priority queue");
+    error_check();
+    bool rval = false;
+    if (exception_setup(true))
+	rval = pq_decrease_key(pq, h, key);
+    exception_cancel();
+    if (rval)
+	report(2, "Decreased key of handle %d to %d", h, key);
+    else
+	report(2, "Could not decrease key of handle %d to %d", h, key);
+    show_pq(3);
+    return !error_check();
+}
+
+/*
+  Compare the heap with the simplest priority queue: a linked list kept
+  in order by inserting each key after all smaller or equal ones, popped
+  from the head.  Both start empty and use the same keys.
+*/
+bool do_pq_bench(int argc, char *argv[])
+{
+    int n, i;
+    bool ok = true;
+    if (argc != 2 || !get_int(argv[1], &n) || n <= 0) {
+	report(1, "%s needs a positive count", argv[0]);
+	return false;
+    }
+    int *keys = malloc(n * sizeof(int));
+    list_ele_t *nodes = malloc(n * sizeof(list_ele_t));
+    if (!keys || !nodes) {
+	report(1, "Could not allocate %d keys", n);
+	free(keys);
+	free(nodes);
+	return false;
+    }
+    unsigned int seed = 1;
+    for (i = 0; i < n; i++)
+	keys[i] = rand_r(&seed);
+
+    double timer;
+    double heap_ins = 0, heap_pop = 0, list_ins = 0, list_pop = 0;
+    unsigned long check_heap = 0, check_list = 0;
+    error_check();
+    /* No time limit: the list takes quadratic time on purpose */
+    if (exception_setup(false)) {
+	pqueue_t *bpq = pq_new();
+	init_time(&timer);
+	for (i = 0; ok && i < n; i++)
+	    ok = pq_insert(bpq, keys[i], NULL);
+	heap_ins = delta_time(&timer);
+	int key;
+	while (pq_pop_min(bpq, &key))
+	    check_heap = check_heap * 31 + key;
+	heap_pop = delta_time(&timer);
+	pq_free(bpq);
+
+	list_ele_t *head = NULL;
+	init_time(&timer);
+	for (i = 0; i < n; i++) {
+	    list_ele_t **link = &head;
+	    while (*link && (*link)->value <= keys[i])
+		link = &(*link)->next;
+	    nodes[i].value = keys[i];
+	    nodes[i].next = *link;
+	    *link = &nodes[i];
+	}
+	list_ins = delta_time(&timer);
+	while (head) {
+	    check_list = check_list * 31 + head->value;
+	    head = head->next;
+	}
+	list_pop = delta_time(&timer);
+    }
+    exception_cancel();
+    free(keys);
+    free(nodes);
+    if (!ok) {
+	report(1, "ERROR:  Heap insertion failed");
+	return false;
+    }
+    if (check_heap != check_list) {
+	report(1, "ERROR:  Heap and sorted list popped different keys");
+	ok = false;
+    }
+    report(1, "%d keys   insert ns/op   pop ns/op", n);
+    report(1, "heap     %12.1f %11.1f", 1e9 * heap_ins / n, 1e9 * heap_pop / n);
+    report(1, "list     %12.1f %11.1f", 1e9 * list_ins / n, 1e9 * list_pop / n);
+    return ok && !error_check();
+}
+
+static bool show_queue(int vlevel)
+{
+    bool ok = true;
+    if (verblevel < vlevel)
+	return true;
+    int cnt = 0;
+    if (q == NULL) {
+	report(vlevel, "q = NULL");
+	return true;
+    }
+    report_noreturn(vlevel, "q = [");
+    q_iter_t it;
+    int val;
+    bool more = false;
+    if (exception_setup(true)) {
+	q_iter_init(q, &it);
+	while (ok && cnt < qcnt && (more = q_iter_next(&it, &val))) {
+	    if (cnt < big_queue_size)
+		report_noreturn(vlevel, cnt == 0 ? "%d" : " %d", val);
+	    cnt++;
+	    ok = ok && !error_check();
+	}
+	if (ok && cnt == qcnt)
+	    more = q_iter_next(&it, &val);
+    }
+    exception_cancel();
+    if (!ok) {
+	report(vlevel, " ... ]");
+	return false;
+    }
+    if (!more) {
+	if (cnt <= big_queue_size)
+	    report(vlevel, "]");
+	else
+	    report(vlevel, " ... ]");
+    } else {
+	report(vlevel, " ... ]");
+	report(vlevel, "ERROR:  Either list has cycle, or queue has more than %d elements",
+	       qcnt);
+	ok = false;
+    }
+    return ok;
+}
+
+bool do_show(int argc, char *argv[])
+{
+    return show_queue(0);
+}
+
+/* Signal handlers */
+void sigsegvhandler(int sig) {
+    trigger_exception("Segmentation fault occurred.  You dereferenced a NULL or invalid pointer");
+}
+
+void sigalrmhandler(int sig) {
+    if (watchdog_expired())
+	trigger_exception("Time limit exceeded.  Either you are in an infinite loop, or your code is too inefficient");
+}
+
+
+static void queue_init() {
+    fail_count = 0;
+    q = NULL;
+    signal(SIGSEGV, sigsegvhandler);
+    signal(SIGALRM, sigalrmhandler);
+}
+
+
+static bool queue_quit(int argc, char *argv[]) {
+    report(3, "Freeing queue");
+    if (exception_setup(true)) {
+	q_free(q);
+	q_free(aux);
+	pq_free(pq);
+    }
+    exception_cancel();
+    size_t bcnt = allocation_check();
+    if (bcnt > 0) {
+	report(1, "ERROR: Freed queue, but %lu blocks are still allocated", bcnt);
+	return false;
+    }
+    return true;
+}
+
+
+static void usage(char *cmd) {
+    printf("Usage: %s [-h] [-f IFILE][-v VLEVEL][-l LFILE][-q BACKEND][-c CFILE]\n"
+	   "\t\t[-s SOCKET][-t MSECS]\n",  cmd);
+    printf("\t-h         Print this information\n");
+    printf("\t-f IFILE   Read commands from IFILE (text or compiled)\n");
+    printf("\t-v VLEVEL  Set verbosity level\n");
+    printf("\t-l LFILE   Echo results to LFILE\n");
+    printf("\t-q BACKEND Queue representation (0 = list, 1 = chunked, 2 = ring)\n");
+    printf("\t-c CFILE   Compile commands into binary trace CFILE and exit\n");
+    printf("\t-s SOCKET  Also serve clients connecting to UNIX socket SOCKET\n");
+    printf("\t-t MSECS   Print service statistics every MSECS milliseconds\n");
+    exit(0);
+}
+
+#define BUFSIZE 256
+
+int main(int argc, char *argv[]) {
+    /* To hold input file name */
+    char buf[BUFSIZE];
+    char *infile_name = NULL;
+    char lbuf[BUFSIZE];
+    char *logfile_name = NULL;
+    char cbuf[BUFSIZE];
+    char *compile_name = NULL;
+    char sbuf[BUFSIZE];
+    char *socket_name = NULL;
+    int stats_ms = 0;
+    int level = 4;
+    int c;
+
+    while ((c = getopt(argc, argv, "hv:f:l:q:c:s:t:")) != -1) {
+	switch(c) {
+	case 'h':
+	    usage(argv[0]);
+	    break;
+	case 'f':
+	    infile_name = strncpy(buf, optarg, BUFSIZE-1);
+	    buf[BUFSIZE-1] = '\0';
+	    break;
+	case 'v':
+	    level = atoi(optarg);
+	    break;
+	case 'l':
+	    logfile_name = strncpy(lbuf, optarg, BUFSIZE-1);
+	    lbuf[BUFSIZE-1] = '\0';
+	    break;
+	case 'q':
+	    queue_backend = atoi(optarg);
+	    break;
+	case 'c':
+	    compile_name = strncpy(cbuf, optarg, BUFSIZE-1);
+	    cbuf[BUFSIZE-1] = '\0';
+	    break;
+	case 's':
+	    socket_name = strncpy(sbuf, optarg, BUFSIZE-1);
+	    sbuf[BUFSIZE-1] = '\0';
+	    break;
+	case 't':
+	    stats_ms = atoi(optarg);
+	    break;
+	default:
+	    printf("Unknown option '%c'\n", c);
+	    usage(argv[0]);
+	    break;
+	}
+    }
+    queue_init();
+    init_cmd();
+    console_init();
+    set_verblevel(level);
+    if (compile_name) {
+	bool ok = compile_cmd_file(infile_name, compile_name);
+	ok = finish_cmd() && ok;
+	return ok ? 0 : 1;
+    }
     if (level > 1) {
 	set_echo(true);
     }
@@ -466,7 +1645,10 @@ int main(int argc, char *argv[]) {
 	set_logfile(logfile_name);
     add_quit_helper(queue_quit);
     bool ok = true;
-    ok = ok && run_console(infile_name);
+    if (socket_name || stats_ms > 0)
+	ok = ok && run_service(infile_name, socket_name, stats_ms);
+    else
+	ok = ok && run_console(infile_name);
     ok = ok && finish_cmd();
     return ok ? 0 : 1;
 }
@@ -7,14 +7,407 @@
  * This program implements a queue supporting both FIFO and LIFO
  * operations.
  *
- * It uses a singly-linked list to represent the set of queue elements
+ * It uses a singly-linked list to represent the set of queue elements,
+ * or optionally an unrolled list of cache-line sized chunks of values
+ * or a growable circular array
  */
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "harness.h"
 #include "queue.h"
+#include "qscan.h"
+
+/************** Element cache ****************/
+
+/*
+  List elements live in slabs of NODE_BATCH owned by the queue.  Removed
+  elements go on the spare list and are handed out again by the next
+  insert, so a queue whose length stays bounded stops calling malloc and
+  free once it has reached its largest size.  The slabs are released
+  only by q_free.
+*/
+
+/* Take an unused element, allocating a new slab if there is none */
+static list_ele_t *node_get(queue_t *q)
+{
+    list_ele_t *e = q->spare;
+    if (e) {
+	q->spare = e->next;
+	return e;
+    }
+    /* Spare list is empty, so nodes[NODE_BATCH-1] becomes its tail */
+    node_slab_t *s = malloc(sizeof(node_slab_t));
+    if (!s)
+	return NULL;
+    s->next = NULL;
+    if (q->last_slab)
+	q->last_slab->next = s;
+    else
+	q->slabs = s;
+    q->last_slab = s;
+    int i;
+    for (i = NODE_BATCH - 1; i > 0; i--) {
+	s->nodes[i].next = q->spare;
+	q->spare = &s->nodes[i];
+    }
+    q->spare_tail = &s->nodes[NODE_BATCH - 1];
+    return &s->nodes[0];
+}
+
+/* Return the chain of elements first .. last to the spare list */
+static inline void node_put_chain(queue_t *q, list_ele_t *first,
+				  list_ele_t *last)
+{
+    if (!q->spare)
+	q->spare_tail = last;
+    last->next = q->spare;
+    q->spare = first;
+}
+
+/* Return an element to the spare list */
+static inline void node_put(queue_t *q, list_ele_t *e)
+{
+    node_put_chain(q, e, e);
+}
+
+/* Give all elements and slabs of q2, in use or spare, to q */
+static void node_adopt(queue_t *q, queue_t *q2)
+{
+    if (q2->slabs) {
+	if (q->last_slab)
+	    q->last_slab->next = q2->slabs;
+	else
+	    q->slabs = q2->slabs;
+	q->last_slab = q2->last_slab;
+    }
+    if (q2->spare)
+	node_put_chain(q, q2->spare, q2->spare_tail);
+    q2->slabs = NULL;
+    q2->last_slab = NULL;
+    q2->spare = NULL;
+    q2->spare_tail = NULL;
+}
+
+/************** Chunked representation ****************/
+
+/*
+  The chunks hold the values in storage order, first->values[first->lo]
+  through last->values[last->hi-1].  When the queue is reversed the head
+  is at the end of the storage order, so reversal is just a flag flip:
+  every operation on the head works on the other end instead.
+*/
+
+/* Allocate an empty chunk whose values will grow from index pos */
+static chunk_t *chunk_new(int pos)
+{
+    chunk_t *c = malloc(sizeof(chunk_t));
+    if (!c)
+	return NULL;
+    c->lo = pos;
+    c->hi = pos;
+    c->next = NULL;
+    c->prev = NULL;
+    return c;
+}
+
+/* Add v before the first value in storage order */
+static bool chunk_push_front(queue_t *q, int v)
+{
+    chunk_t *c = q->first;
+    if (!c || c->lo == 0) {
+	c = chunk_new(CHUNK_VALUES);
+	if (!c)
+	    return false;
+	c->next = q->first;
+	if (q->first)
+	    q->first->prev = c;
+	else
+	    q->last = c;
+	q->first = c;
+    }
+    c->values[--c->lo] = v;
+    q->size++;
+    return true;
+}
+
+/* Add v after the last value in storage order */
+static bool chunk_push_back(queue_t *q, int v)
+{
+    chunk_t *c = q->last;
+    if (!c || c->hi == CHUNK_VALUES) {
+	c = chunk_new(0);
+	if (!c)
+	    return false;
+	c->prev = q->last;
+	if (q->last)
+	    q->last->next = c;
+	else
+	    q->first = c;
+	q->last = c;
+    }
+    c->values[c->hi++] = v;
+    q->size++;
+    return true;
+}
+
+/* Remove and return the first value in storage order.  Queue nonempty */
+static int chunk_pop_front(queue_t *q)
+{
+    chunk_t *c = q->first;
+    int v = c->values[c->lo++];
+    if (c->lo == c->hi) {
+	q->first = c->next;
+	if (q->first)
+	    q->first->prev = NULL;
+	else
+	    q->last = NULL;
+	free(c);
+    }
+    q->size--;
+    return v;
+}
+
+/* Remove and return the last value in storage order.  Queue nonempty */
+static int chunk_pop_back(queue_t *q)
+{
+    chunk_t *c = q->last;
+    int v = c->values[--c->hi];
+    if (c->lo == c->hi) {
+	q->last = c->prev;
+	if (q->last)
+	    q->last->next = NULL;
+	else
+	    q->first = NULL;
+	free(c);
+    }
+    q->size--;
+    return v;
+}
+
+/*
+  Reverse the storage order of q and toggle q->reversed,
+  so the queue holds the same values from head to tail
+*/
+static void chunk_flip(queue_t *q)
+{
+    chunk_t *c = q->first;
+    while (c) {
+	int i, j;
+	for (i = 0, j = CHUNK_VALUES - 1; i < j; i++, j--) {
+	    int t = c->values[i];
+	    c->values[i] = c->values[j];
+	    c->values[j] = t;
+	}
+	int lo = c->lo;
+	c->lo = CHUNK_VALUES - c->hi;
+	c->hi = CHUNK_VALUES - lo;
+	chunk_t *next = c->next;
+	c->next = c->prev;
+	c->prev = next;
+	c = next;
+    }
+    c = q->first;
+    q->first = q->last;
+    q->last = c;
+    q->reversed = !q->reversed;
+}
+
+/*
+  Split the storage order of q before value s, moving values s ..
+  size-1 into empty queue q2.  Allocates at most one chunk, when s
+  falls inside a chunk.
+*/
+static bool chunk_split_storage(queue_t *q, int s, queue_t *q2)
+{
+    chunk_t *c = q->first;
+    int before = 0;
+    while (c && before + (c->hi - c->lo) <= s) {
+	before += c->hi - c->lo;
+	c = c->next;
+    }
+    if (!c)
+	return true;
+    int off = s - before;
+    if (off > 0) {
+	chunk_t *n = chunk_new(0);
+	if (!n)
+	    return false;
+	n->hi = c->hi - c->lo - off;
+	memcpy(n->values, &c->values[c->lo + off], n->hi * sizeof(int));
+	c->hi = c->lo + off;
+	n->next = c->next;
+	if (c->next)
+	    c->next->prev = n;
+	else
+	    q->last = n;
+	n->prev = c;
+	c->next = n;
+	c = n;
+    }
+    q2->first = c;
+    q2->last = q->last;
+    q->last = c->prev;
+    if (q->last)
+	q->last->next = NULL;
+    else
+	q->first = NULL;
+    c->prev = NULL;
+    q2->size = q->size - s;
+    q->size = s;
+    return true;
+}
+
+/************** Circular array representation ****************/
+
+/*
+  Value i in storage order is ring[(start + i) & (capacity - 1)].
+  As with chunks, a reversed queue has its head at the end.
+*/
+
+/* Capacity of a ring when the first value is inserted */
+#define RING_INIT 16
+
+/* Storage slot of value i */
+static inline int ring_slot(queue_t *q, int i)
+{
+    return (q->start + i) & (q->capacity - 1);
+}
+
+/* Value at position i counting from the head */
+static inline int ring_get(queue_t *q, int i)
+{
+    return q->ring[ring_slot(q, q->reversed ? q->size - 1 - i : i)];
+}
+
+/* Make room for n values in all, doubling the capacity as needed */
+static bool ring_grow(queue_t *q, int n)
+{
+    if (n <= q->capacity)
+	return true;
+    int newcap = q->capacity ? 2 * q->capacity : RING_INIT;
+    while (newcap < n)
+	newcap *= 2;
+    int *newring = malloc(newcap * sizeof(int));
+    if (!newring)
+	return false;
+    int i;
+    for (i = 0; i < q->size; i++)
+	newring[i] = q->ring[ring_slot(q, i)];
+    if (q->ring)
+	free(q->ring);
+    q->ring = newring;
+    q->capacity = newcap;
+    q->start = 0;
+    return true;
+}
+
+/* Make room for one more value */
+static inline bool ring_reserve(queue_t *q)
+{
+    return ring_grow(q, q->size + 1);
+}
+
+/* Add v before the first value in storage order */
+static bool ring_push_front(queue_t *q, int v)
+{
+    if (!ring_reserve(q))
+	return false;
+    q->start = ring_slot(q, -1);
+    q->ring[q->start] = v;
+    q->size++;
+    return true;
+}
+
+/* Add v after the last value in storage order */
+static bool ring_push_back(queue_t *q, int v)
+{
+    if (!ring_reserve(q))
+	return false;
+    q->ring[ring_slot(q, q->size)] = v;
+    q->size++;
+    return true;
+}
+
+/* Remove and return the first value in storage order.  Queue nonempty */
+static int ring_pop_front(queue_t *q)
+{
+    int v = q->ring[q->start];
+    q->start = ring_slot(q, 1);
+    q->size--;
+    return v;
+}
+
+/* Remove and return the last value in storage order.  Queue nonempty */
+static int ring_pop_back(queue_t *q)
+{
+    q->size--;
+    return q->ring[ring_slot(q, q->size)];
+}
+
+/************** Scans over contiguous values ****************/
+
+/*
+  Chunked and circular array queues store their values in runs of
+  consecutive ints, so searches and aggregates hand whole runs to the
+  vectorized loops in qscan.c.
+*/
+
+/* Walk over the runs of values of a chunked or circular array queue */
+typedef struct {
+    queue_t *q;
+    chunk_t *chunk;
+    const int *ring_run[2]; /* Ring: its (at most) two runs, in walk order */
+    int ring_len[2];
+    int part;
+    bool backward;          /* Runs in reverse storage order */
+} run_iter_t;
+
+static void run_init(queue_t *q, run_iter_t *r, bool backward)
+{
+    r->q = q;
+    r->chunk = backward ? q->last : q->first;
+    r->part = 0;
+    r->backward = backward;
+    if (q->backend == Q_RING) {
+	/* Slots start .. capacity-1, then 0 .. for values that wrap */
+	int first = q->capacity - q->start;
+	if (first > q->size)
+	    first = q->size;
+	int a = backward ? 1 : 0;
+	r->ring_run[a] = q->ring + q->start;
+	r->ring_len[a] = first;
+	r->ring_run[1 - a] = q->ring;
+	r->ring_len[1 - a] = q->size - first;
+    }
+}
+
+/* Store next run at *ap, *np and return true, or return false at the end */
+static bool run_next(run_iter_t *r, const int **ap, int *np)
+{
+    if (r->q->backend == Q_CHUNK) {
+	chunk_t *c = r->chunk;
+	if (!c)
+	    return false;
+	*ap = &c->values[c->lo];
+	*np = c->hi - c->lo;
+	r->chunk = r->backward ? c->prev : c->next;
+	return true;
+    }
+    while (r->part < 2) {
+	int i = r->part++;
+	if (r->ring_len[i] > 0) {
+	    *ap = r->ring_run[i];
+	    *np = r->ring_len[i];
+	    return true;
+	}
+    }
+    return false;
+}
+
+/************** Queue operations ****************/
 
 /*
   Create empty queue.
@@ -22,6 +415,18 @@
 */
 queue_t *q_new()
 {
+    return q_new_backend(Q_LIST);
+}
+
+/*
+  Create empty queue with the given representation.
+  Return NULL if could not allocate space or backend is invalid.
+*/
+queue_t *q_new_backend(q_backend_t backend)
+{
+    if (backend < 0 || backend >= Q_NUM_BACKENDS)
+	return NULL;
+
     queue_t *q =  malloc(sizeof(queue_t));
 
     /* What if malloc returned NULL? */
@@ -32,7 +437,18 @@ queue_t *q_new()
 
     q->head = NULL;
     q->tail = NULL;
+    q->spare = NULL;
+    q->spare_tail = NULL;
+    q->slabs = NULL;
+    q->last_slab = NULL;
     q->size = 0;
+    q->backend = backend;
+    q->first = NULL;
+    q->last = NULL;
+    q->ring = NULL;
+    q->capacity = 0;
+    q->start = 0;
+    q->reversed = false;
     return q;
 }
 
@@ -43,12 +459,24 @@ void q_free(queue_t *q)
   {
     return;
   }
-  list_ele_t *elem = NULL;
-  while (q->head)
+  /* List elements, in use or spare, all live in the slabs */
+  node_slab_t *s;
+  while (q->slabs)
+  {
+    s = q->slabs;
+    q->slabs = s->next;
+    free(s);
+  }
+  chunk_t *c;
+  while (q->first)
   {
-    elem = q->head;
-    q->head = q->head->next;
-    free(elem);
+    c = q->first;
+    q->first = c->next;
+    free(c);
+  }
+  if (q->ring)
+  {
+    free(q->ring);
   }
   
     /* How about freeing the list elements? */
@@ -69,7 +497,12 @@ bool q_insert_head(queue_t *q, int v)
     if (!q)
 	    return false;
 
-    newh = malloc(sizeof(list_ele_t));
+    if (q->backend == Q_CHUNK)
+	return q->reversed ? chunk_push_back(q, v) : chunk_push_front(q, v);
+    if (q->backend == Q_RING)
+	return q->reversed ? ring_push_back(q, v) : ring_push_front(q, v);
+
+    newh = node_get(q);
     /* What if malloc returned NULL? */
     if (!newh)
 	    return false;
@@ -98,8 +531,13 @@ bool q_insert_tail(queue_t *q, int v)
 	if (!q)
 		return false;
 
+	if (q->backend == Q_CHUNK)
+		return q->reversed ? chunk_push_front(q, v) : chunk_push_back(q, v);
+	if (q->backend == Q_RING)
+		return q->reversed ? ring_push_front(q, v) : ring_push_back(q, v);
+
   list_ele_t *newt;
-  newt = malloc(sizeof(list_ele_t));
+  newt = node_get(q);
 
 	if (!newt)
 		return false;
@@ -130,18 +568,32 @@ bool q_insert_tail(queue_t *q, int v)
 */
 bool q_remove_head(queue_t *q, int *vp)
 {
-	if (!q || !q->head)
+	if (!q || q->size == 0)
 	{
 		return false;
 	}
 
+	if (q->backend != Q_LIST)
+	{
+		int v;
+		if (q->backend == Q_CHUNK)
+			v = q->reversed ? chunk_pop_back(q) : chunk_pop_front(q);
+		else
+			v = q->reversed ? ring_pop_back(q) : ring_pop_front(q);
+		if (vp)
+		{
+			*vp = v;
+		}
+		return true;
+	}
+
   list_ele_t *temp = q->head;
 	if (vp)
 	{
 		*vp = q->head->value;
 	}
   q->head = temp->next;
-  free(temp);
+  node_put(q, temp);
 	--(q->size);
     	return true;
 }
@@ -165,6 +617,8 @@ int q_size(queue_t *q)
   Your implementation must not allocate or free any elements (e.g., by
   calling q_insert_head or q_remove_head).  Instead, it should modify
   the pointers in the existing data structure.
+  Chunked and circular array queues only flip which end of their
+  storage is the head.
  */
 void q_reverse(queue_t *q)
 {
@@ -173,6 +627,12 @@ void q_reverse(queue_t *q)
 		return;
 	}
 
+	if (q->backend != Q_LIST)
+	{
+		q->reversed = !q->reversed;
+		return;
+	}
+
 	list_ele_t *prevElem;
 	list_ele_t *currElem;
 	list_ele_t *nextElem;
@@ -192,3 +652,504 @@ void q_reverse(queue_t *q)
 	q->head = prevElem;
 }
 
+
+/*
+  Insert the n values vals[0] .. vals[n-1] at tail of queue, in order.
+  Return number of values inserted, which is less than n
+  if could not allocate space.
+ */
+int q_insert_tail_many(queue_t *q, const int *vals, int n)
+{
+    if (!q || n <= 0)
+	return 0;
+    int i;
+    if (q->backend == Q_CHUNK) {
+	for (i = 0; i < n; i++)
+	    if (!(q->reversed ? chunk_push_front(q, vals[i])
+		  : chunk_push_back(q, vals[i])))
+		break;
+	return i;
+    }
+    if (q->backend == Q_RING) {
+	/* One resize up front, then no checks per value */
+	if (!ring_grow(q, q->size + n))
+	    return 0;
+	for (i = 0; i < n; i++) {
+	    if (q->reversed)
+		ring_push_front(q, vals[i]);
+	    else
+		ring_push_back(q, vals[i]);
+	}
+	return n;
+    }
+
+    /* Build the chain privately and link it in once */
+    list_ele_t *first = NULL, *last = NULL;
+    for (i = 0; i < n; i++) {
+	list_ele_t *e = node_get(q);
+	if (!e)
+	    break;
+	e->value = vals[i];
+	if (last)
+	    last->next = e;
+	else
+	    first = e;
+	last = e;
+    }
+    if (!first)
+	return 0;
+    last->next = NULL;
+    if (q->size == 0)
+	q->head = first;
+    else
+	q->tail->next = first;
+    q->tail = last;
+    q->size += i;
+    return i;
+}
+
+/*
+  Remove up to n elements from head of queue.
+  If vals non-NULL, store removed values at vals[0] onward.
+  Return number of elements removed.
+ */
+int q_remove_head_many(queue_t *q, int *vals, int n)
+{
+    if (!q || n <= 0)
+	return 0;
+    if (n > q->size)
+	n = q->size;
+    int i;
+    if (q->backend != Q_LIST) {
+	for (i = 0; i < n; i++) {
+	    int v;
+	    if (q->backend == Q_CHUNK)
+		v = q->reversed ? chunk_pop_back(q) : chunk_pop_front(q);
+	    else
+		v = q->reversed ? ring_pop_back(q) : ring_pop_front(q);
+	    if (vals)
+		vals[i] = v;
+	}
+	return n;
+    }
+    if (n == 0)
+	return 0;
+
+    /* Copy out the run, then recycle it as one chain */
+    list_ele_t *first = q->head;
+    list_ele_t *last = first;
+    for (i = 0; ; i++) {
+	if (vals)
+	    vals[i] = last->value;
+	if (i == n - 1)
+	    break;
+	last = last->next;
+    }
+    q->head = last->next;
+    q->size -= n;
+    node_put_chain(q, first, last);
+    return n;
+}
+
+/*
+  Move all elements of q2 to tail of q, leaving q2 empty.
+  Return false if either queue is NULL, they are the same queue,
+  or their representations differ.
+ */
+bool q_concat(queue_t *q, queue_t *q2)
+{
+    if (!q || !q2 || q == q2 || q->backend != q2->backend)
+	return false;
+
+    if (q->backend == Q_RING) {
+	if (!ring_grow(q, q->size + q2->size))
+	    return false;
+	int i;
+	for (i = 0; i < q2->size; i++) {
+	    if (q->reversed)
+		ring_push_front(q, ring_get(q2, i));
+	    else
+		ring_push_back(q, ring_get(q2, i));
+	}
+	if (q2->ring)
+	    free(q2->ring);
+	q2->ring = NULL;
+	q2->capacity = 0;
+	q2->start = 0;
+	q2->size = 0;
+	q2->reversed = false;
+	return true;
+    }
+
+    if (q->backend == Q_CHUNK) {
+	if (q2->size == 0)
+	    return true;
+	if (q->size == 0)
+	    q->reversed = q2->reversed;
+	else if (q->reversed != q2->reversed)
+	    chunk_flip(q2);
+	if (!q->first) {
+	    q->first = q2->first;
+	    q->last = q2->last;
+	} else if (q->reversed) {
+	    /* Tail is at the front of the storage order */
+	    q2->last->next = q->first;
+	    q->first->prev = q2->last;
+	    q->first = q2->first;
+	} else {
+	    q->last->next = q2->first;
+	    q2->first->prev = q->last;
+	    q->last = q2->last;
+	}
+	q->size += q2->size;
+	q2->first = NULL;
+	q2->last = NULL;
+	q2->size = 0;
+	q2->reversed = false;
+	return true;
+    }
+
+    /* The elements of q2 live in its slabs, so q takes those over too */
+    if (q2->size > 0) {
+	if (q->size == 0)
+	    q->head = q2->head;
+	else
+	    q->tail->next = q2->head;
+	q->tail = q2->tail;
+	q->size += q2->size;
+    }
+    node_adopt(q, q2);
+    q2->head = NULL;
+    q2->tail = NULL;
+    q2->size = 0;
+    return true;
+}
+
+/*
+  Move elements k .. size-1 of q (counting from head) to empty queue q2.
+  Return false, leaving both queues unchanged, if either queue is NULL,
+  q2 is not empty, k is out of range, or could not allocate space.
+ */
+bool q_split(queue_t *q, int k, queue_t *q2)
+{
+    if (!q || !q2 || q == q2 || q->backend != q2->backend
+	|| q2->size != 0 || k < 0 || k > q->size)
+	return false;
+    int m = q->size - k;
+
+    if (q->backend == Q_RING) {
+	q2->reversed = false;
+	if (!ring_grow(q2, m))
+	    return false;
+	int i;
+	for (i = k; i < q->size; i++)
+	    ring_push_back(q2, ring_get(q, i));
+	/* Reversed, the moved values are at the front of the storage */
+	if (q->reversed)
+	    q->start = ring_slot(q, m);
+	q->size = k;
+	return true;
+    }
+
+    if (q->backend == Q_CHUNK) {
+	q2->reversed = q->reversed;
+	if (!q->reversed)
+	    return chunk_split_storage(q, k, q2);
+	/* Head end is at the back: q keeps the storage suffix */
+	if (!chunk_split_storage(q, m, q2))
+	    return false;
+	chunk_t *first = q->first, *last = q->last;
+	q->first = q2->first;
+	q->last = q2->last;
+	q2->first = first;
+	q2->last = last;
+	int size = q->size;
+	q->size = q2->size;
+	q2->size = size;
+	return true;
+    }
+
+    /*
+      Elements must stay in the slabs of the queue that frees them, so
+      copy the values into elements of q2 and recycle the originals
+    */
+    if (m == 0)
+	return true;
+    list_ele_t *prev = NULL;
+    list_ele_t *e = q->head;
+    int i;
+    for (i = 0; i < k; i++) {
+	prev = e;
+	e = e->next;
+    }
+    list_ele_t *moved = e;
+    for (; e; e = e->next) {
+	if (!q_insert_tail(q2, e->value)) {
+	    /* Undo */
+	    if (q2->head)
+		node_put_chain(q2, q2->head, q2->tail);
+	    q2->head = NULL;
+	    q2->tail = NULL;
+	    q2->size = 0;
+	    return false;
+	}
+    }
+    node_put_chain(q, moved, q->tail);
+    if (prev) {
+	prev->next = NULL;
+	q->tail = prev;
+    } else {
+	q->head = NULL;
+	q->tail = NULL;
+    }
+    q->size = k;
+    return true;
+}
+
+/*
+  Merge sorted chains a and b, which must not both be empty.  On equal
+  values the element of a comes first, so a must hold the earlier ones.
+*/
+static list_ele_t *list_merge(list_ele_t *a, list_ele_t *b)
+{
+    list_ele_t head;
+    list_ele_t *t = &head;
+    while (a && b) {
+	if (b->value < a->value) {
+	    t->next = b;
+	    t = b;
+	    b = b->next;
+	} else {
+	    t->next = a;
+	    t = a;
+	    a = a->next;
+	}
+    }
+    t->next = a ? a : b;
+    return head.next;
+}
+
+/* Ascending order of ints for qsort */
+static int compare_int(const void *a, const void *b)
+{
+    int x = *(const int *) a;
+    int y = *(const int *) b;
+    return (x > y) - (x < y);
+}
+
+/*
+  Sort elements of queue in ascending order.
+
+  Lists use a bottom-up merge sort: pending[i] holds a sorted run of
+  2^i elements, and each new element is carried up through the occupied
+  slots like incrementing a binary counter.  Runs are merged while they
+  are still small and warm in the cache, and the slots live on the stack.
+ */
+bool q_sort(queue_t *q)
+{
+    if (!q)
+	return false;
+    if (q->size < 2)
+	return true;
+
+    if (q->backend != Q_LIST) {
+	int *vals = malloc(q->size * sizeof(int));
+	if (!vals)
+	    return false;
+	q_iter_t it;
+	int i = 0;
+	q_iter_init(q, &it);
+	while (q_iter_next(&it, &vals[i]))
+	    i++;
+	qsort(vals, q->size, sizeof(int), compare_int);
+	/* Write back in storage order */
+	if (q->backend == Q_RING) {
+	    for (i = 0; i < q->size; i++)
+		q->ring[i] = vals[i];
+	    q->start = 0;
+	    q->reversed = false;
+	} else {
+	    chunk_t *c;
+	    i = q->reversed ? q->size - 1 : 0;
+	    for (c = q->first; c; c = c->next) {
+		int j;
+		for (j = c->lo; j < c->hi; j++) {
+		    c->values[j] = vals[i];
+		    i += q->reversed ? -1 : 1;
+		}
+	    }
+	}
+	free(vals);
+	return true;
+    }
+
+    /* Nothing to do if already in order */
+    list_ele_t *e = q->head;
+    while (e->next && e->value <= e->next->value)
+	e = e->next;
+    if (!e->next)
+	return true;
+
+    list_ele_t *pending[8 * sizeof(int)] = {NULL};
+    int i;
+    e = q->head;
+    while (e) {
+	list_ele_t *carry = e;
+	e = e->next;
+	carry->next = NULL;
+	for (i = 0; pending[i]; i++) {
+	    carry = list_merge(pending[i], carry);
+	    pending[i] = NULL;
+	}
+	pending[i] = carry;
+    }
+    /* Higher slots hold earlier elements */
+    list_ele_t *result = NULL;
+    for (i = 0; i < 8 * sizeof(int); i++)
+	if (pending[i])
+	    result = result ? list_merge(pending[i], result) : pending[i];
+    q->head = result;
+    for (e = result; e->next; e = e->next)
+	;
+    q->tail = e;
+    return true;
+}
+
+/*
+  Return position, counting from 0 at head, of first element equal to v.
+  Return -1 if q is NULL or v not found.
+ */
+int q_find(queue_t *q, int v)
+{
+    if (!q)
+	return -1;
+    int pos = 0;
+    if (q->backend == Q_LIST) {
+	list_ele_t *e;
+	for (e = q->head; e; e = e->next, pos++)
+	    if (e->value == v)
+		return pos;
+	return -1;
+    }
+    /* Reversed, the head is the end of storage: search backward */
+    run_iter_t r;
+    const int *a;
+    int n;
+    run_init(q, &r, q->reversed);
+    while (run_next(&r, &a, &n)) {
+	int i = q->reversed ? qscan_last(a, n, v) : qscan_first(a, n, v);
+	if (i >= 0)
+	    return pos + (q->reversed ? n - 1 - i : i);
+	pos += n;
+    }
+    return -1;
+}
+
+/*
+  Return number of elements x with (x cmp v).
+  Return 0 if q is NULL or empty.
+ */
+int q_count_if(queue_t *q, q_cmp_t cmp, int v)
+{
+    if (!q)
+	return 0;
+    int cnt = 0;
+    if (q->backend == Q_LIST) {
+	list_ele_t *e;
+	for (e = q->head; e; e = e->next)
+	    cnt += cmp_holds(e->value, cmp, v);
+	return cnt;
+    }
+    run_iter_t r;
+    const int *a;
+    int n;
+    run_init(q, &r, false);
+    while (run_next(&r, &a, &n))
+	cnt += qscan_count(a, n, cmp, v);
+    return cnt;
+}
+
+/*
+  Return sum of all elements.
+  Return 0 if q is NULL or empty.
+ */
+long long q_sum(queue_t *q)
+{
+    if (!q)
+	return 0;
+    long long sum = 0;
+    if (q->backend == Q_LIST) {
+	list_ele_t *e;
+	for (e = q->head; e; e = e->next)
+	    sum += e->value;
+	return sum;
+    }
+    run_iter_t r;
+    const int *a;
+    int n;
+    run_init(q, &r, false);
+    while (run_next(&r, &a, &n))
+	sum += qscan_sum(a, n);
+    return sum;
+}
+
+/*
+  Start walking q from head to tail.
+  q may be NULL, in which case the walk is empty.
+ */
+void q_iter_init(queue_t *q, q_iter_t *it)
+{
+    it->q = q;
+    it->ele = q ? q->head : NULL;
+    it->chunk = NULL;
+    it->pos = 0;
+    if (q && q->backend == Q_CHUNK) {
+	it->chunk = q->reversed ? q->last : q->first;
+	if (it->chunk)
+	    it->pos = q->reversed ? it->chunk->hi - 1 : it->chunk->lo;
+    }
+    if (q && q->backend == Q_RING)
+	it->pos = q->reversed ? q->size - 1 : 0;
+}
+
+/*
+  Store next value at *vp and return true,
+  or return false when past the tail.
+ */
+bool q_iter_next(q_iter_t *it, int *vp)
+{
+    if (!it->q)
+	return false;
+    if (it->q->backend == Q_LIST) {
+	if (!it->ele)
+	    return false;
+	*vp = it->ele->value;
+	it->ele = it->ele->next;
+	return true;
+    }
+    if (it->q->backend == Q_RING) {
+	if (it->pos < 0 || it->pos >= it->q->size)
+	    return false;
+	*vp = it->q->ring[ring_slot(it->q, it->pos)];
+	it->pos += it->q->reversed ? -1 : 1;
+	return true;
+    }
+    chunk_t *c = it->chunk;
+    if (!c)
+	return false;
+    *vp = c->values[it->pos];
+    if (it->q->reversed) {
+	if (--it->pos < c->lo) {
+	    it->chunk = c->prev;
+	    if (it->chunk)
+		it->pos = it->chunk->hi - 1;
+	}
+    } else {
+	if (++it->pos == c->hi) {
+	    it->chunk = c->next;
+	    if (it->chunk)
+		it->pos = it->chunk->lo;
+	}
+    }
+    return true;
+}
@@ -7,7 +7,9 @@
  * This program implements a queue supporting both FIFO and LIFO
  * operations.
  *
- * It uses a singly-linked list to represent the set of queue elements
+ * It uses a singly-linked list to represent the set of queue elements,
+ * or optionally an unrolled list of cache-line sized chunks of values
+ * or a growable circular array
  */
 
 #include <stdbool.h>
@@ -20,17 +22,72 @@ typedef struct ELE {
     struct ELE *next;
 } list_ele_t;
 
+/* Number of list elements carved out of one allocation */
+#define NODE_BATCH 32
+
+/*
+  Block of list elements.  A list queue recycles the elements it
+  removes and only calls malloc when all of its slabs are in use.
+*/
+typedef struct SLAB {
+    struct SLAB *next;
+    list_ele_t nodes[NODE_BATCH];
+} node_slab_t;
+
+/* Number of values held by a chunk: one cache line */
+#define CHUNK_VALUES (64 / sizeof(int))
+
+/*
+  Unrolled list node.  Holds the values values[lo] .. values[hi-1].
+  Chunks are doubly linked so that either end can grow or shrink.
+*/
+typedef struct CHUNK {
+    int values[CHUNK_VALUES];
+    int lo;
+    int hi;
+    struct CHUNK *next;
+    struct CHUNK *prev;
+} chunk_t;
+
+/* Queue representations, selected when the queue is created */
+typedef enum {
+    Q_LIST,   /* One list_ele_t per value */
+    Q_CHUNK,  /* Unrolled list of chunk_t */
+    Q_RING,   /* Power-of-two circular array */
+    Q_NUM_BACKENDS
+} q_backend_t;
+
 /* Queue structure */
 typedef struct {
-    list_ele_t *head;  /* Linked list of elements */
+    list_ele_t *head;  /* Linked list of elements (Q_LIST) */
     list_ele_t *tail;
+    list_ele_t *spare; /* Unused elements, linked through next */
+    list_ele_t *spare_tail;
+    node_slab_t *slabs; /* Storage of all elements */
+    node_slab_t *last_slab;
     int size;
-    /*
-      You will need to add more fields to this structure
-      to efficiently implement q_size and q_insert_tail
-    */
+    q_backend_t backend;
+    chunk_t *first;    /* Chunks in storage order (Q_CHUNK) */
+    chunk_t *last;
+    int *ring;         /* Circular array of capacity values (Q_RING) */
+    int capacity;
+    int start;         /* Index of first value in storage order */
+    bool reversed;     /* Queue head is at the end of the storage order */
 } queue_t;
 
+/* Comparisons for q_count_if: element OP value */
+typedef enum {
+    Q_EQ, Q_NE, Q_LT, Q_LE, Q_GT, Q_GE
+} q_cmp_t;
+
+/* Cursor for walking a queue from head to tail */
+typedef struct {
+    queue_t *q;
+    list_ele_t *ele;
+    chunk_t *chunk;
+    int pos;
+} q_iter_t;
+
 /************** Operations on queue ************************/
 
 /*
@@ -39,6 +96,12 @@ typedef struct {
 */
 queue_t *q_new();
 
+/*
+  Create empty queue with the given representation.
+  Return NULL if could not allocate space or backend is invalid.
+*/
+queue_t *q_new_backend(q_backend_t backend);
+
 /*
   Free all storage used by queue.
   No effect if q is NULL
@@ -79,3 +142,79 @@ int q_size(queue_t *q);
   No effect if q is NULL or empty
  */
 void q_reverse(queue_t *q);
+
+/*
+  Insert the n values vals[0] .. vals[n-1] at tail of queue, in order.
+  Return number of values inserted, which is less than n
+  if could not allocate space.
+  Return 0 if q is NULL.
+ */
+int q_insert_tail_many(queue_t *q, const int *vals, int n);
+
+/*
+  Remove up to n elements from head of queue.
+  If vals non-NULL, store removed values at vals[0] onward.
+  Return number of elements removed.
+  Return 0 if q is NULL or empty.
+ */
+int q_remove_head_many(queue_t *q, int *vals, int n);
+
+/*
+  Move all elements of q2 to tail of q, leaving q2 empty.
+  Both queues must have the same representation.
+  Runs in O(1) time for lists, and for chunked queues reversed the same
+  number of times.  Circular arrays copy the values of q2.
+  Return false if either queue is NULL, they are the same queue,
+  or their representations differ.
+ */
+bool q_concat(queue_t *q, queue_t *q2);
+
+/*
+  Move elements k .. size-1 of q (counting from head) to empty queue q2,
+  which must have the same representation.
+  Return true if successful.
+  Return false if either queue is NULL, q2 is not empty, k is out of
+  range, or could not allocate space, leaving both queues unchanged.
+ */
+bool q_split(queue_t *q, int k, queue_t *q2);
+
+/*
+  Sort elements of queue in ascending order.
+  Lists are merge sorted in place without allocating; the order of equal
+  values is preserved.  Chunked and circular array queues sort a copy of
+  their values.
+  Return false if q is NULL or could not allocate space.
+ */
+bool q_sort(queue_t *q);
+
+/*
+  Return position, counting from 0 at head, of first element equal to v.
+  Return -1 if q is NULL or v not found.
+  Chunked and circular array queues compare four values at a time.
+ */
+int q_find(queue_t *q, int v);
+
+/*
+  Return number of elements x with (x cmp v), for example x < v for Q_LT.
+  Return 0 if q is NULL or empty.
+ */
+int q_count_if(queue_t *q, q_cmp_t cmp, int v);
+
+/*
+  Return sum of all elements, without overflow.
+  Return 0 if q is NULL or empty.
+ */
+long long q_sum(queue_t *q);
+
+/*
+  Start walking q from head to tail.
+  q may be NULL, in which case the walk is empty.
+ */
+void q_iter_init(queue_t *q, q_iter_t *it);
+
+/*
+  Store next value at *vp and return true,
+  or return false when past the tail.
+  The queue must not change during the walk.
+ */
+bool q_iter_next(q_iter_t *it, int *vp);
@@ -9,6 +9,11 @@
 #include <stdbool.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <fcntl.h>
 
 #include "report.h"
 
@@ -19,6 +24,13 @@ FILE *verbfile = NULL;
 FILE *logfile = NULL;
 
 int verblevel = 0;
+
+/* Binary logging (see below) */
+typedef enum { LOG_REPORT, LOG_NORETURN, LOG_EVENT, LOG_FORMAT } log_kind_t;
+static bool binlog_on = false;
+static void binlog_record(int kind, int level, char *fmt, va_list ap);
+static void binlog_flush_all();
+
 void init_files(FILE *efile, FILE *vfile)
 {
     errfile = efile;
@@ -66,6 +78,14 @@ void report_event(message_t msg, char *fmt, ...)
 	return;
     if (!errfile)
 	init_files(stdout, stdout);
+    if (binlog_on) {
+	va_start(ap, fmt);
+	binlog_record(LOG_EVENT, msg, fmt, ap);
+	va_end(ap);
+	/* Errors are still shown as they happen */
+	if (fatal)
+	    binlog_flush_all();
+    }
     va_start(ap, fmt);
     fprintf(errfile, "%s: ", msg_name);
     vfprintf(errfile, fmt, ap);
@@ -94,19 +114,24 @@ void report(int level, char *fmt, ...)
     va_list ap;
     if (!verbfile)
 	init_files(stdout, stdout);
-    if (level <= verblevel) {
-	va_start(ap, fmt);
+    if (level > verblevel)
+	return;
+    va_start(ap, fmt);
+    if (binlog_on)
+	binlog_record(LOG_REPORT, level, fmt, ap);
+    else {
 	vfprintf(verbfile, fmt, ap);
 	fprintf(verbfile, "\n");
 	fflush(verbfile);
+    }
+    va_end(ap);
+    /* The log file gets formatted text either way */
+    if (logfile) {
+	va_start(ap, fmt);
+	vfprintf(logfile, fmt, ap);
+	fprintf(logfile, "\n");
+	fflush(logfile);
 	va_end(ap);
-	if (logfile) {
-	    va_start(ap, fmt);
-	    vfprintf(logfile, fmt, ap);
-	    fprintf(logfile, "\n");
-	    fflush(logfile);
-	    va_end(ap);
-	}
     }
 }
 
@@ -115,18 +140,495 @@ void report_noreturn(int level, char *fmt, ...)
     va_list ap;
     if (!verbfile)
 	init_files(stdout, stdout);
-    if (level <= verblevel) {
-	va_start(ap, fmt);
+    if (level > verblevel)
+	return;
+    va_start(ap, fmt);
+    if (binlog_on)
+	binlog_record(LOG_NORETURN, level, fmt, ap);
+    else {
 	vfprintf(verbfile, fmt, ap);
 	fflush(verbfile);
+    }
+    va_end(ap);
+    if (logfile) {
+	va_start(ap, fmt);
+	vfprintf(logfile, fmt, ap);
+	fflush(logfile);
 	va_end(ap);
-	if (logfile) {
-	    va_start(ap, fmt);
-	    vfprintf(logfile, fmt, ap);
-	    fflush(logfile);
-	    va_end(ap);
+    }
+}
+
+/*
+  Binary logging.  While it is on, report, report_noreturn, and
+  report_event append a fixed-size record to a ring buffer instead of
+  formatting: a timestamp, the level, the format string (by address, as
+  its id), and the arguments, with strings copied into the record.
+  Formatting happens only when the records are dumped.
+
+  If a file is given, a background thread copies records to it as they
+  accumulate, writing each format string once before its first use, and
+  the ring never overwrites records that have not been written.  Without
+  a file the ring keeps just the most recent records.
+*/
+
+#define LOG_MAXARGS 6
+#define LOG_TEXT 56
+#define LOG_MAGIC 0x474f4c51   /* "QLOG" */
+
+typedef union {
+    long long i;
+    double d;
+    void *p;
+} log_arg_t;
+
+typedef struct {
+    uint64_t ns;             /* CLOCK_MONOTONIC time */
+    uint64_t fmt;            /* Address of format string */
+    int32_t level;           /* Level, or message type for events */
+    uint8_t kind;            /* log_kind_t */
+    uint8_t nargs;
+    uint16_t text_used;
+    log_arg_t args[LOG_MAXARGS];  /* Strings hold offsets into text */
+    char text[LOG_TEXT];
+} log_rec_t;
+
+static log_rec_t *log_ring = NULL;
+static size_t log_mask = 0;
+/* Records written by the main thread, and records written to the file */
+static _Atomic size_t log_head = 0;
+static _Atomic size_t log_flushed = 0;
+
+static FILE *binfile = NULL;
+static pthread_t flusher;
+static pthread_mutex_t flush_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flush_cond = PTHREAD_COND_INITIALIZER;
+static bool flusher_stop = false;
+
+/* Formats already written to binfile: open addressing on address */
+#define LOG_FORMATS 1024
+static uint64_t written_fmt[LOG_FORMATS];
+
+/* Argument taken by a conversion */
+typedef enum { ARG_NONE, ARG_INT, ARG_LONG, ARG_DOUBLE, ARG_STRING,
+	       ARG_POINTER } arg_type_t;
+
+/*
+  Parse the conversion starting at the '%' at fmt.  Return argument type,
+  set *end just past the conversion, and set *stars to the number of '*'
+  widths or precisions, each of which takes an int argument first
+*/
+static arg_type_t parse_conv(const char *fmt, const char **end, int *stars) {
+    const char *f = fmt + 1;
+    int longs = 0;
+    *stars = 0;
+    while (*f && strchr("-+ #0", *f))
+	f++;
+    while (*f && ((*f >= '0' && *f <= '9') || *f == '.' || *f == '*')) {
+	if (*f == '*')
+	    (*stars)++;
+	f++;
+    }
+    while (*f && strchr("hlLqjzt", *f)) {
+	if (*f != 'h')
+	    longs++;
+	f++;
+    }
+    char c = *f;
+    *end = c ? f + 1 : f;
+    switch (c) {
+    case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+	return longs ? ARG_LONG : ARG_INT;
+    case 'e': case 'E': case 'f': case 'F': case 'g': case 'G':
+    case 'a': case 'A':
+	return ARG_DOUBLE;
+    case 's':
+	return ARG_STRING;
+    case 'p':
+	return ARG_POINTER;
+    default:
+	return ARG_NONE;
+    }
+}
+
+static uint64_t log_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void binlog_record(int kind, int level, char *fmt, va_list ap) {
+    size_t head = atomic_load_explicit(&log_head, memory_order_relaxed);
+    if (binfile && head - atomic_load_explicit(&log_flushed, memory_order_acquire)
+	> log_mask) {
+	/* Ring full of unwritten records.  Write them out here */
+	binlog_flush_all();
+    }
+    log_rec_t *r = &log_ring[head & log_mask];
+    r->ns = log_now();
+    r->fmt = (uint64_t) (uintptr_t) fmt;
+    r->level = level;
+    r->kind = kind;
+    r->nargs = 0;
+    r->text_used = 0;
+    const char *f = fmt;
+    while ((f = strchr(f, '%')) != NULL) {
+	const char *end;
+	int stars;
+	arg_type_t t = parse_conv(f, &end, &stars);
+	f = end;
+	if (t == ARG_NONE)
+	    continue;
+	if (r->nargs + stars >= LOG_MAXARGS)
+	    break;
+	while (stars-- > 0)
+	    r->args[r->nargs++].i = va_arg(ap, int);
+	log_arg_t *a = &r->args[r->nargs++];
+	switch (t) {
+	case ARG_INT:
+	    a->i = va_arg(ap, int);
+	    break;
+	case ARG_LONG:
+	    a->i = va_arg(ap, long long);
+	    break;
+	case ARG_DOUBLE:
+	    a->d = va_arg(ap, double);
+	    break;
+	case ARG_POINTER:
+	    a->p = va_arg(ap, void *);
+	    break;
+	case ARG_STRING: {
+	    const char *str = va_arg(ap, const char *);
+	    size_t room = LOG_TEXT - r->text_used;
+	    if (room == 0) {
+		a->i = -1;
+		break;
+	    }
+	    size_t len = str ? strnlen(str, room - 1) : 0;
+	    a->i = r->text_used;
+	    memcpy(r->text + r->text_used, str ? str : "", len);
+	    r->text[r->text_used + len] = '\0';
+	    r->text_used += len + 1;
+	    break;
+	}
+	default:
+	    break;
+	}
+    }
+    atomic_store_explicit(&log_head, head + 1, memory_order_release);
+    if (binfile && ((head + 1) & (log_mask >> 1)) == 0)
+	pthread_cond_signal(&flush_cond);
+}
+
+/*
+  Print record, using format string fmt.  Lines start with the time
+  since start; *midline tracks whether the last record ended a line
+*/
+static void format_record(FILE *out, log_rec_t *r, const char *fmt,
+			  uint64_t start, bool *midline) {
+    static const char *event_name[] = { "WARNING", "ERROR", "FATAL ERROR" };
+    char spec[64];
+    int argi = 0;
+    if (!*midline)
+	fprintf(out, "[%12.6f] ", (r->ns - start) * 1e-9);
+    if (r->kind == LOG_EVENT)
+	fprintf(out, "%s: ", event_name[r->level < 3 ? r->level : 2]);
+    const char *f = fmt;
+    while (*f) {
+	const char *pct = strchr(f, '%');
+	if (!pct) {
+	    fputs(f, out);
+	    break;
+	}
+	fwrite(f, 1, pct - f, out);
+	if (pct[1] == '%') {
+	    fputc('%', out);
+	    f = pct + 2;
+	    continue;
+	}
+	const char *end;
+	int stars;
+	arg_type_t t = parse_conv(pct, &end, &stars);
+	size_t len = end - pct;
+	if (len >= sizeof(spec) || t == ARG_NONE || stars > 1
+	    || argi + stars >= r->nargs) {
+	    /* Unknown conversion or missing argument.  Show it as is */
+	    fwrite(pct, 1, len, out);
+	    f = end;
+	    continue;
+	}
+	memcpy(spec, pct, len);
+	spec[len] = '\0';
+	int width = stars ? (int) r->args[argi++].i : 0;
+	log_arg_t *a = &r->args[argi++];
+	switch (t) {
+	case ARG_INT:
+	    if (stars)
+		fprintf(out, spec, width, (int) a->i);
+	    else
+		fprintf(out, spec, (int) a->i);
+	    break;
+	case ARG_LONG:
+	    if (stars)
+		fprintf(out, spec, width, a->i);
+	    else
+		fprintf(out, spec, a->i);
+	    break;
+	case ARG_DOUBLE:
+	    if (stars)
+		fprintf(out, spec, width, a->d);
+	    else
+		fprintf(out, spec, a->d);
+	    break;
+	case ARG_POINTER:
+	    if (stars)
+		fprintf(out, spec, width, a->p);
+	    else
+		fprintf(out, spec, a->p);
+	    break;
+	case ARG_STRING: {
+	    const char *str = a->i >= 0 && a->i < LOG_TEXT ? r->text + a->i : "...";
+	    if (stars)
+		fprintf(out, spec, width, str);
+	    else
+		fprintf(out, spec, str);
+	    break;
+	}
+	default:
+	    break;
+	}
+	f = end;
+    }
+    *midline = r->kind == LOG_NORETURN;
+    if (!*midline)
+	fputc('\n', out);
+}
+
+/* Write a format string definition unless already in binfile */
+static bool write_format(uint64_t fmt) {
+    size_t i = (size_t) ((fmt * 0x9E3779B97F4A7C15ULL) >> 54) & (LOG_FORMATS - 1);
+    size_t probes;
+    for (probes = 0; probes < LOG_FORMATS; probes++) {
+	if (written_fmt[i] == fmt)
+	    return true;
+	if (written_fmt[i] == 0)
+	    break;
+	i = (i + 1) & (LOG_FORMATS - 1);
+    }
+    if (probes < LOG_FORMATS)
+	written_fmt[i] = fmt;
+    const char *str = (const char *) (uintptr_t) fmt;
+    log_rec_t def;
+    memset(&def, 0, sizeof(def));
+    def.fmt = fmt;
+    def.kind = LOG_FORMAT;
+    /* Length of string that follows the record, including null */
+    def.args[0].i = strlen(str) + 1;
+    return fwrite(&def, sizeof(def), 1, binfile) == 1
+	&& fwrite(str, 1, def.args[0].i, binfile) == (size_t) def.args[0].i;
+}
+
+/* Write records that are in the ring but not yet in the file */
+static void flush_pending() {
+    size_t head = atomic_load_explicit(&log_head, memory_order_acquire);
+    size_t i = atomic_load_explicit(&log_flushed, memory_order_relaxed);
+    /* Records overwritten while writes were failing are gone */
+    if (head - i > log_mask + 1)
+	i = head - (log_mask + 1);
+    for (; i < head; i++) {
+	log_rec_t *r = &log_ring[i & log_mask];
+	if (!write_format(r->fmt) || fwrite(r, sizeof(*r), 1, binfile) != 1)
+	    break;
+    }
+    fflush(binfile);
+    /* Only as far as written, so a failed record is tried again */
+    atomic_store_explicit(&log_flushed, i, memory_order_release);
+}
+
+static void binlog_flush_all() {
+    if (!binfile)
+	return;
+    pthread_mutex_lock(&flush_lock);
+    flush_pending();
+    pthread_mutex_unlock(&flush_lock);
+}
+
+static void *flusher_main(void *arg) {
+    pthread_mutex_lock(&flush_lock);
+    while (!flusher_stop) {
+	struct timespec wake;
+	clock_gettime(CLOCK_REALTIME, &wake);
+	wake.tv_nsec += 50000000;
+	if (wake.tv_nsec >= 1000000000) {
+	    wake.tv_sec++;
+	    wake.tv_nsec -= 1000000000;
+	}
+	pthread_cond_timedwait(&flush_cond, &flush_lock, &wake);
+	flush_pending();
+    }
+    pthread_mutex_unlock(&flush_lock);
+    return NULL;
+}
+
+bool binlog_start(char *file_name, size_t records) {
+    size_t cap = 1;
+    if (binlog_on)
+	binlog_stop();
+    while (cap < records)
+	cap <<= 1;
+    log_ring = calloc(cap, sizeof(log_rec_t));
+    if (!log_ring)
+	return false;
+    log_mask = cap - 1;
+    atomic_store(&log_head, 0);
+    atomic_store(&log_flushed, 0);
+    if (file_name) {
+	binfile = fopen(file_name, "w");
+	uint32_t header[2] = { LOG_MAGIC, sizeof(log_rec_t) };
+	if (!binfile || fwrite(header, sizeof(header), 1, binfile) != 1) {
+	    if (binfile)
+		fclose(binfile);
+	    binfile = NULL;
+	    free(log_ring);
+	    log_ring = NULL;
+	    return false;
+	}
+	memset(written_fmt, 0, sizeof(written_fmt));
+	flusher_stop = false;
+	/* Timeouts and faults must go to the main thread */
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	int err = pthread_create(&flusher, NULL, flusher_main, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (err) {
+	    /* Nothing would ever be written after the header */
+	    fclose(binfile);
+	    binfile = NULL;
+	    remove(file_name);
+	    free(log_ring);
+	    log_ring = NULL;
+	    return false;
+	}
+    }
+    binlog_on = true;
+    return true;
+}
+
+void binlog_stop() {
+    if (!binlog_on)
+	return;
+    binlog_on = false;
+    if (binfile) {
+	pthread_mutex_lock(&flush_lock);
+	flusher_stop = true;
+	pthread_cond_signal(&flush_cond);
+	pthread_mutex_unlock(&flush_lock);
+	pthread_join(flusher, NULL);
+	flush_pending();
+	fclose(binfile);
+	binfile = NULL;
+    }
+    free(log_ring);
+    log_ring = NULL;
+}
+
+/* Could r have been written by binlog_record? */
+static bool record_valid(log_rec_t *r) {
+    return r->kind <= LOG_EVENT && r->nargs <= LOG_MAXARGS
+	&& r->text_used <= LOG_TEXT;
+}
+
+long binlog_dump(size_t n, bool show) {
+    if (!verbfile)
+	init_files(stdout, stdout);
+    if (!log_ring)
+	return 0;
+    size_t head = atomic_load(&log_head);
+    size_t avail = head < log_mask + 1 ? head : log_mask + 1;
+    if (n == 0 || n > avail)
+	n = avail;
+    size_t i;
+    uint64_t start = n ? log_ring[(head - avail) & log_mask].ns : 0;
+    bool midline = false;
+    for (i = head - n; i < head; i++) {
+	log_rec_t *r = &log_ring[i & log_mask];
+	if (!record_valid(r))
+	    break;
+	if (show)
+	    format_record(verbfile, r, (const char *) (uintptr_t) r->fmt, start,
+			  &midline);
+    }
+    if (midline)
+	fputc('\n', verbfile);
+    fflush(verbfile);
+    return i == head ? (long) n : -1;
+}
+
+bool binlog_dump_file(char *file_name, bool show) {
+    if (!verbfile)
+	init_files(stdout, stdout);
+    FILE *fp = fopen(file_name, "r");
+    if (!fp)
+	return false;
+    uint32_t header[2];
+    bool ok = fread(header, sizeof(header), 1, fp) == 1
+	&& header[0] == LOG_MAGIC && header[1] == sizeof(log_rec_t);
+    /* Format strings seen so far, in order of definition */
+    size_t nfmts = 0, cap = 0;
+    uint64_t *ids = NULL;
+    char **strs = NULL;
+    uint64_t start = 0;
+    bool first = true;
+    bool midline = false;
+    log_rec_t r;
+    size_t got;
+    while (ok && (got = fread(&r, 1, sizeof(r), fp)) > 0) {
+	/* A partial record means the writer stopped mid-way */
+	ok = got == sizeof(r) && (r.kind == LOG_FORMAT || record_valid(&r));
+	if (!ok)
+	    break;
+	if (r.kind == LOG_FORMAT) {
+	    size_t len = r.args[0].i;
+	    char *str = malloc(len ? len : 1);
+	    if (nfmts == cap) {
+		cap = cap ? 2 * cap : 64;
+		ids = realloc(ids, cap * sizeof(uint64_t));
+		strs = realloc(strs, cap * sizeof(char *));
+	    }
+	    ok = str && ids && strs && len > 0 && fread(str, 1, len, fp) == len;
+	    if (ok) {
+		str[len - 1] = '\0';
+		ids[nfmts] = r.fmt;
+		strs[nfmts++] = str;
+	    } else
+		free(str);
+	    continue;
+	}
+	/* Latest definition wins.  Each is written before its first use */
+	size_t k = nfmts;
+	while (k > 0 && ids[k - 1] != r.fmt)
+	    k--;
+	if (k == 0) {
+	    ok = false;
+	    break;
+	}
+	if (first) {
+	    start = r.ns;
+	    first = false;
 	}
+	if (show)
+	    format_record(verbfile, &r, strs[k - 1], start, &midline);
     }
+    if (midline)
+	fputc('\n', verbfile);
+    size_t k;
+    for (k = 0; k < nfmts; k++)
+	free(strs[k]);
+    free(ids);
+    free(strs);
+    fclose(fp);
+    fflush(verbfile);
+    return ok;
 }
 
 void safe_report(int level, char *msg)
@@ -154,6 +656,7 @@ void fail_fun(char *format, char *msg) {
     fail_buf[strlen(fail_buf)] = '\n';
     /* Use write to avoid any buffering issues */
     rval = write(STDOUT_FILENO, fail_buf, strlen(fail_buf)+1);
+    binlog_flush_all();
     if (logfile) {
 	/* Don't know file descriptor for logfile */
 	fputs(fail_buf, logfile);
@@ -180,6 +683,80 @@ size_t peak_bytes = 0;
 size_t last_peak_bytes = 0;
 size_t current_bytes = 0;
 
+/*
+  Per-callsite accounting, keyed by the fun_name given to the allocating
+  function.  Every block carries a header naming its site, so that the
+  free functions can charge it back.
+*/
+typedef struct {
+    char *name;
+    size_t cnt;           /* Allocations */
+    size_t frees;
+    size_t bytes;         /* Total bytes allocated */
+    size_t current;
+    size_t peak;
+    uint64_t ns;          /* Time spent allocating and freeing */
+} site_t;
+
+#define MAX_SITES 256
+static site_t sites[MAX_SITES];
+static size_t site_cnt = 0;
+/* Used once the table is full */
+static site_t other_site = { "(other)" };
+
+typedef union {
+    site_t *site;
+    max_align_t align;
+} block_header_t;
+
+static site_t *find_site(char *name) {
+    unsigned h = 2166136261u;
+    char *c;
+    for (c = name; *c; c++) {
+	h ^= (unsigned char) *c;
+	h *= 16777619u;
+    }
+    size_t i = h & (MAX_SITES - 1);
+    size_t probes;
+    for (probes = 0; probes < MAX_SITES; probes++) {
+	site_t *s = &sites[i];
+	if (s->name == NULL) {
+	    if (site_cnt >= MAX_SITES / 2)
+		break;
+	    s->name = name;
+	    site_cnt++;
+	    return s;
+	}
+	if (s->name == name || strcmp(s->name, name) == 0)
+	    return s;
+	i = (i + 1) & (MAX_SITES - 1);
+    }
+    return &other_site;
+}
+
+static uint64_t site_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Record allocation of bytes for site, and attach site to block */
+static void *site_alloc(block_header_t *h, site_t *s, size_t bytes,
+			uint64_t start) {
+    h->site = s;
+    s->cnt++;
+    s->bytes += bytes;
+    s->current += bytes;
+    s->peak = MAX(s->peak, s->current);
+    s->ns += site_now() - start;
+    allocate_cnt++;
+    allocate_bytes += bytes;
+    current_bytes += bytes;
+    peak_bytes = MAX(peak_bytes, current_bytes);
+    last_peak_bytes = MAX(last_peak_bytes, current_bytes);
+    return h + 1;
+}
+
 static void check_exceed(size_t new_bytes) {
     size_t limit_bytes = (size_t) mblimit << 20;
     size_t request_bytes = new_bytes + current_bytes;
@@ -191,34 +768,39 @@ static void check_exceed(size_t new_bytes) {
 /* Call malloc & exit if fails */
 void * malloc_or_fail(size_t bytes, char *fun_name) {
     check_exceed(bytes);
-    void *p = malloc(bytes);
-    if (!p) {
+    uint64_t start = site_now();
+    block_header_t *h = malloc(sizeof(block_header_t) + bytes);
+    if (!h) {
 	fail_fun("Malloc returned NULL in %s", fun_name);
 	return NULL;
     }
-    allocate_cnt++;
-    allocate_bytes += bytes;
-    current_bytes += bytes;
-    peak_bytes = MAX(peak_bytes, current_bytes);
-    last_peak_bytes = MAX(last_peak_bytes, current_bytes);
-    return p;
+    return site_alloc(h, find_site(fun_name), bytes, start);
 }
 
 /* Call calloc returns NULL & exit if fails */
 void *calloc_or_fail(size_t cnt, size_t bytes, char *fun_name) {
     check_exceed(cnt*bytes);
-    void *p = calloc(cnt, bytes);
-    if (!p) {
+    uint64_t start = site_now();
+    block_header_t *h = NULL;
+    if (bytes == 0 || cnt <= (SIZE_MAX - sizeof(block_header_t)) / bytes)
+	h = calloc(1, sizeof(block_header_t) + cnt * bytes);
+    if (!h) {
 	fail_fun("Calloc returned NULL in %s", fun_name);
 	return NULL;
     }
-    allocate_cnt++;
-    allocate_bytes += cnt * bytes;
-    current_bytes += cnt * bytes;
-    peak_bytes = MAX(peak_bytes, current_bytes);
-    last_peak_bytes = MAX(last_peak_bytes, current_bytes);
+    return site_alloc(h, find_site(fun_name), cnt * bytes, start);
+}
+
+/* Header of block, which is where the underlying allocation starts */
+static block_header_t *block_header(void *b) {
+    return (block_header_t *) b - 1;
+}
 
-    return p;
+/* Charge free of bytes to site */
+static void site_free(site_t *s, size_t bytes, uint64_t start) {
+    s->frees++;
+    s->current -= bytes;
+    s->ns += site_now() - start;
 }
 
 /* Call realloc returns NULL & exit if fails.
@@ -227,19 +809,22 @@ void * realloc_or_fail(void *old, size_t old_bytes, size_t new_bytes,
 		       char *fun_name) {
     if (new_bytes > old_bytes) 
 	check_exceed(new_bytes-old_bytes);
-    void *p = realloc(old, new_bytes);
-    if (!p) {
+    uint64_t start = site_now();
+    block_header_t *h = old ? block_header(old) : NULL;
+    site_t *old_site = h ? h->site : NULL;
+    h = realloc(h, sizeof(block_header_t) + new_bytes);
+    if (!h) {
 	fail_fun("Realloc returned NULL in %s", fun_name);
 	return NULL;
     }
-    allocate_cnt++;
-    allocate_bytes += new_bytes;
-    current_bytes += (new_bytes-old_bytes);
-    peak_bytes = MAX(peak_bytes, current_bytes);
-    last_peak_bytes = MAX(last_peak_bytes, current_bytes);
+    if (old_site) {
+	old_site->frees++;
+	old_site->current -= old_bytes;
+    }
     free_cnt++;
     free_bytes += old_bytes;
-    return p;
+    current_bytes -= old_bytes;
+    return site_alloc(h, find_site(fun_name), new_bytes, start);
 }
 
 char *strsave_or_fail(char *s, char *fun_name) {
@@ -247,16 +832,12 @@ char *strsave_or_fail(char *s, char *fun_name) {
 	return NULL;
     size_t len = strlen(s);
     check_exceed(len+1);
-    char *ss = malloc(len+1);
-    if (!ss) {
+    uint64_t start = site_now();
+    block_header_t *h = malloc(sizeof(block_header_t) + len + 1);
+    if (!h) {
 	fail_fun("strsave failed in %s", fun_name);
     }
-    allocate_cnt++;
-    allocate_bytes += len+1;
-    current_bytes += len+1;
-    peak_bytes = MAX(peak_bytes, current_bytes);
-    last_peak_bytes = MAX(last_peak_bytes, current_bytes);
-
+    char *ss = site_alloc(h, find_site(fun_name), len + 1, start);
     return strcpy(ss, s);
 }
 
@@ -264,8 +845,13 @@ char *strsave_or_fail(char *s, char *fun_name) {
 void free_block(void *b, size_t bytes) {
     if (b == NULL) {
 	report_event(MSG_ERROR, "Attempting to free null block");
+	return;
     }
-    free(b);
+    uint64_t start = site_now();
+    block_header_t *h = block_header(b);
+    site_t *s = h->site;
+    free(h);
+    site_free(s, bytes, start);
     free_cnt++;
     free_bytes += bytes;
     current_bytes -= bytes;
@@ -273,14 +859,7 @@ void free_block(void *b, size_t bytes) {
 
 /* Free array, as from calloc */
 void free_array(void *b, size_t cnt, size_t bytes) {
-    if (b == NULL) {
-	report_event(MSG_ERROR, "Attempting to free null block");
-    }
-    free(b);
-    free_cnt++;
-    free_bytes += cnt * bytes;
-    current_bytes -= cnt * bytes;
-
+    free_block(b, cnt * bytes);
 }
 
 /* Free string saved by strsave_or_fail */
@@ -291,6 +870,51 @@ void free_string(char *s) {
     free_block((void *) s, strlen(s)+1);
 }
 
+/* Order for mem_sites, per sort key */
+static site_key_t sort_key;
+static int site_cmp(const void *a, const void *b) {
+    const site_t *x = *(const site_t **) a;
+    const site_t *y = *(const site_t **) b;
+    size_t vx, vy;
+    switch (sort_key) {
+    case SITE_CNT:
+	vx = x->cnt, vy = y->cnt;
+	break;
+    case SITE_PEAK:
+	vx = x->peak, vy = y->peak;
+	break;
+    case SITE_TIME:
+	vx = x->ns, vy = y->ns;
+	break;
+    default:
+	vx = x->bytes, vy = y->bytes;
+	break;
+    }
+    if (vx != vy)
+	return vx < vy ? 1 : -1;
+    return strcmp(x->name, y->name);
+}
+
+void mem_sites(int n, site_key_t key) {
+    site_t *list[MAX_SITES + 1];
+    size_t cnt = 0, i;
+    for (i = 0; i < MAX_SITES; i++)
+	if (sites[i].name)
+	    list[cnt++] = &sites[i];
+    if (other_site.cnt > 0)
+	list[cnt++] = &other_site;
+    sort_key = key;
+    qsort(list, cnt, sizeof(site_t *), site_cmp);
+    report(1, "%-20s %10s %10s %12s %10s %10s %10s",
+	   "Site", "Allocs", "Frees", "Bytes", "Current", "Peak", "usecs");
+    for (i = 0; i < cnt && (n <= 0 || i < n); i++) {
+	site_t *s = list[i];
+	report(1, "%-20s %10lu %10lu %12lu %10lu %10lu %10.1f", s->name,
+	       (unsigned long) s->cnt, (unsigned long) s->frees,
+	       (unsigned long) s->bytes, (unsigned long) s->current,
+	       (unsigned long) s->peak, s->ns * 1e-3);
+    }
+}
 
 /* Report current allocation status */
 void mem_status(FILE *fp) {
@@ -309,17 +933,36 @@ void init_time(double *timep) {
     (void) delta_time(timep);
 }
 
+/* Seconds on clock */
+static double clock_seconds(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + 1.0E-9 * ts.tv_nsec;
+}
+
 double delta_time(double *timep) {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    double current_time = tv.tv_sec + 1.0E-6 * tv.tv_usec;
+    double current_time = clock_seconds(CLOCK_MONOTONIC);
     double delta = current_time - *timep;
     *timep = current_time;
     return delta;
 }
 
-/* Number of bytes resident in physical memory */
+/* Descriptor for /proc/self/statm, kept open and reread from the start */
+static int statm_fd = -2;
+
+/* Number of bytes resident in physical memory now */
 size_t resident_bytes() {
+    char buf[128];
+    size_t pages, resident;
+    if (statm_fd == -2)
+	statm_fd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+    ssize_t n = statm_fd >= 0 ? pread(statm_fd, buf, sizeof(buf) - 1, 0) : -1;
+    if (n > 0) {
+	buf[n] = '\0';
+	if (sscanf(buf, "%zu %zu", &pages, &resident) == 2)
+	    return resident * (size_t) sysconf(_SC_PAGESIZE);
+    }
+    /* No /proc.  Fall back on the peak */
     struct rusage r;
     size_t mem = 0;
     int code = getrusage(RUSAGE_SELF, &r);
@@ -331,6 +974,12 @@ size_t resident_bytes() {
     return mem;
 }
 
+void sample_usage(usage_t *u) {
+    u->wall = clock_seconds(CLOCK_MONOTONIC);
+    u->cpu = clock_seconds(CLOCK_THREAD_CPUTIME_ID);
+    u->rss = resident_bytes();
+}
+
 double gigabytes(size_t n) {
     return (double) n / (1UL << 30);
 }
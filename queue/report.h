@@ -39,6 +39,30 @@ void report(int verblevel, char *fmt, ...);
 /* Like report, but without return character */
 void report_noreturn(int verblevel, char *fmt, ...);
 
+/*
+  Binary logging.  Reports are recorded unformatted in a ring buffer of
+  (at least) records entries, and formatted only when dumped.  If
+  file_name is not NULL, records are also written to that file by a
+  background thread.  Return false if logging could not be started
+*/
+bool binlog_start(char *file_name, size_t records);
+
+/* Write out any remaining records and return to formatted output */
+void binlog_stop();
+
+/*
+  Format the last n records in the ring (all if n == 0), or only check
+  them if show is false.  Return how many, or -1 if one is damaged
+*/
+long binlog_dump(size_t n, bool show);
+
+/*
+  Format the records in a file written by binary logging, or only check
+  them if show is false.  Return false if it can't be read, or is
+  damaged or cut short
+*/
+bool binlog_dump_file(char *file_name, bool show);
+
 /* Simple failure report.  Works even when malloc returns NULL */
 void fail_fun(char *format, char *msg);
 
@@ -70,9 +94,18 @@ void free_string(char *s);
 /* Report current allocation status */
 void mem_status(FILE *fp);
 
+/* Orders for per-callsite allocation table */
+typedef enum { SITE_BYTES, SITE_CNT, SITE_PEAK, SITE_TIME } site_key_t;
+
+/*
+  Report allocations by site (the fun_name given to the functions above),
+  largest first by key.  Show the top n (all if n <= 0)
+*/
+void mem_sites(int n, site_key_t key);
+
 /** Time measurement.  **/
 
-/* Time counted as fp number in seconds */
+/* Time counted as fp number in seconds, on the monotonic clock */
 void init_time(double *timep);
 
 /* Compute time since last call with this timer
@@ -81,9 +114,18 @@ double delta_time(double *timep);
 
 /** Memory usage **/
 
-/* Number of bytes resident in physical memory */
+/* Number of bytes resident in physical memory now */
 size_t resident_bytes();
 
+/* Resource usage at one point in time */
+typedef struct {
+    double wall;      /* Monotonic clock, in seconds */
+    double cpu;       /* CPU time of calling thread, in seconds */
+    size_t rss;       /* Resident bytes */
+} usage_t;
+
+void sample_usage(usage_t *u);
+
 /* Convert bytes to gigabytes */
 double gigabytes(size_t bytes);
 
@@ -0,0 +1,27 @@
+# Compare list, chunked and ring queues on the trace-14 workload
+option fail 0
+option malloc 0
+option backend 0
+new
+time ih 2 1000000
+time it 3 1000000
+time size 1000
+time reverse
+time rh 3
+free
+option backend 1
+new
+time ih 2 1000000
+time it 3 1000000
+time size 1000
+time reverse
+time rh 3
+free
+option backend 2
+new
+time ih 2 1000000
+time it 3 1000000
+time size 1000
+time reverse
+time rh 3
+free
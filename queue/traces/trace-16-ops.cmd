@@ -0,0 +1,40 @@
+# Test of itm, rhm, split, concat, and swap
+option fail 0
+option malloc 0
+new
+itm 1 10
+rhm 3 1
+split 4
+size
+swap
+size
+rhm 3 8
+swap
+ih 0
+concat
+size
+rh 0
+rh 4
+rh 5
+rh 6
+rh 7
+reverse
+itm 11 3
+split 2
+concat
+rh 11
+rh 12
+rh 13
+size
+split 0
+concat
+itm 20 50
+split 45
+swap
+rhm 10 65
+size
+concat
+reverse
+rhm 1 64
+rh 63
+free
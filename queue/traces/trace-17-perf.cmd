@@ -0,0 +1,36 @@
+# Test performance of bulk insert, remove, split, and concat
+option fail 0
+option malloc 0
+option backend 0
+new
+time itm 0 1000000
+time split 500000
+time concat
+reverse
+time rhm 900000
+time itm 0 900000
+time split 1
+time concat
+free
+option backend 1
+new
+time itm 0 1000000
+time split 500000
+time concat
+reverse
+time rhm 900000
+time itm 0 900000
+time split 1
+time concat
+free
+option backend 2
+new
+time itm 0 1000000
+time split 500000
+time concat
+reverse
+time rhm 900000
+time itm 0 900000
+time split 1
+time concat
+free
@@ -0,0 +1,33 @@
+# Test of sort on small queues, with duplicates, and after reverse
+option fail 0
+option malloc 0
+new
+sort
+ih 3
+sort
+rh 3
+it 2
+it 2
+it 1
+ih 5
+it -4
+sort
+size
+rh -4
+rh 1
+it 0
+sort
+rh 0
+rh 2
+rh 2
+rh 5
+size
+itm 1 20
+reverse
+sort
+rhm 20 1
+itr 200 50
+sort
+reverse
+sort
+free
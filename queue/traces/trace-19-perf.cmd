@@ -0,0 +1,31 @@
+# Test performance of sort on random, sorted, and reverse sorted queues
+option fail 0
+option malloc 0
+option backend 0
+new
+itr 500000
+time sort
+time sort
+reverse
+time sort
+free
+new
+itm 0 4000000
+time sort
+reverse
+time sort
+free
+option backend 1
+new
+itr 1000000
+time sort
+reverse
+time sort
+free
+option backend 2
+new
+itr 1000000
+time sort
+reverse
+time sort
+free
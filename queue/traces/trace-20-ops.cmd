@@ -0,0 +1,27 @@
+# Test of priority queue insert, remove, and decrease key
+option fail 10
+option malloc 0
+pnew
+pr
+pi 5
+pi 3
+pi 9
+pi 7
+pi 3
+pr 3
+pr 3
+pdk 2 1
+pdk 0 6
+pr 1
+pi 8
+pi 2
+pdk 3 0
+pr 0
+pr 2
+pr 5
+pr 8
+pr
+pi 4 20
+pir 200 100
+prm 220
+pfree
@@ -0,0 +1,9 @@
+# Test performance of priority queue insert and remove
+option fail 0
+option malloc 0
+pnew
+time pir 1000000
+time prm 1000000
+time pi 7 1000000
+time prm 500000
+pfree
@@ -0,0 +1,32 @@
+# Test of find, count, and sum, including empty and reversed queues
+option fail 0
+option malloc 0
+new
+find 1
+count eq 1
+sum
+ih 3
+it 5
+ih -2 20
+it 9
+find 3
+find 9
+find -2
+find 4
+count lt 0
+count ge 5
+count ne -2
+sum
+reverse
+find 3
+find -2
+count le 3
+sum
+itr 500 40
+reverse
+find 39
+count gt 20
+sum
+rhm 30
+sum
+free
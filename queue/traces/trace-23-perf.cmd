@@ -0,0 +1,29 @@
+# Test performance of find, count, and sum
+option fail 0
+option malloc 0
+option backend 0
+new
+itr 1000000
+time find -1 20
+time count lt 1000000000 20
+time sum 20
+free
+option backend 1
+new
+itr 1000000
+time find -1 100
+time count lt 1000000000 100
+time sum 100
+reverse
+time find -1 100
+free
+option backend 2
+new
+itr 1000000
+ih 7 1000
+time find -1 100
+time count lt 1000000000 100
+time sum 100
+reverse
+time find -1 100
+free
@@ -0,0 +1,25 @@
+# Test of binary logging: operations still checked while output is recorded,
+# and dump finds as many intact records as asked for
+option fail 0
+option malloc 0
+option verbose 2
+binlog - 16
+new
+ih 1 10
+it 20
+rh 1
+rhm 5
+size
+sort
+show
+dump -c 6
+binlog - 4
+reverse
+rh 20
+rh 1
+rh 1
+rh 1
+size
+dump -c 4
+binlog off
+free
@@ -0,0 +1,18 @@
+# Test of deterministic allocation failures, by position, by function, and by seed
+option fail 200
+option malloc 0
+fault q_new_backend nth 1
+new
+fault clear
+new
+option seed 7
+option malloc 30
+ih 1 500
+it 2 500
+option malloc 0
+fault every 3
+ih 3 500
+reverse
+rhm 2000
+fault clear
+free
@@ -0,0 +1,15 @@
+# Test that size, insert_head, and insert_tail each take constant time, with a 20 ms limit per operation
+option fail 0
+option malloc 0
+new
+ih 2 100000
+it 3 100000
+option timeout 20000
+size 1000
+ih 4
+it 5
+size 1000
+rh 4
+option timeout 1000000
+reverse
+free